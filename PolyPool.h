@@ -14,18 +14,29 @@
 //  */
 // #define POLYPOOL_ENABLE_EXCEPTIONS
 
+#include "PolyPoolBlocks.h"
+#include "PolyPoolClosed.h"
+#include "PolyPoolExecutor.h"
 #include "PolyPoolIterator.h"
+#include "PolyPoolMemory.h"
+#include "PolyPoolSegment.h"
+#include "PolyPoolSnapshot.h"
+#include "PolyPoolType.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <typeindex>
 #include <typeinfo>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
-#include "boost/poly_collection/base_collection.hpp"
-
-/** Polymorphic object pool written in C++11 using RTTI.
+/** Open-world polymorphic object pool written in C++11 using RTTI.
 
     Typical goals of an object pool are:
     * fast object creation and deletion
@@ -38,23 +49,25 @@
     * possible wasted space due to fixed-size chunks and unused free objects
     * extra memory needed to track free objects
     * for optimal performance, block size must be set for each type
-      based on application usage
+      based on application usage, or left to a growth policy such as
+      PolyPoolGrowth::geometric()
 
     Types are registered the first time a default block size is set or
-    object is added to the pool.
+    object is added to the pool. Each type gets its own segment of
+    blocks (see PolyPoolSegment.h), found by a single hash lookup.
 
     All types stored must be children of the root type or the root
     type itself.
 
-    OPTIMIZE: Consider using boost::unordered_set & boost::unordered_map.
-    See: https://tinodidriksen.com/2012/02/cpp-set-performance-2/
+    If every type to be stored is known at compile time, prefer the
+    closed-world PolyPool<Root, Types...> (see PolyPoolClosed.h),
+    which needs neither RTTI nor hash lookups.
 
-    OPTIMIZE: Consider creating simpler alternative to
-    boost::poly_collection if duplicating its type registry and
-    working around its quirks proves inefficient.
+    OPTIMIZE: Consider using boost::unordered_map.
+    See: https://tinodidriksen.com/2012/02/cpp-set-performance-2/
  */
 template <typename Root>
-class PolyPool
+class PolyPool<Root>
 {
 public:
     // using enable_if_subtype=
@@ -72,73 +85,100 @@ public:
     // using enable_if_acceptable=
     //     typename std::enable_if<is_acceptable<Root>::value>::type*;
 
-    using base_collection_iterator=
-        typename boost::base_collection<Root>::iterator;
-    using block_list_iterator=
-        typename std::vector<boost::base_collection<Root> >::iterator;
     using size_type=std::size_t;
+    using segment_list=PolyPoolVector<PolyPoolOwner<PolyPoolSegmentBase<Root> > >;
+    template <typename Child>
+    using Handle=PolyPoolHandle<Child>;
 
     PolyPool()
+        : PolyPool(PolyPoolMemoryResource::defaultResource())
     {
-        mBlocks.emplace_back();
     }
 
-    PolyPool(size_type defaultBlockSize)
-#ifdef POLYPOOL_REQUIRE_REGISTRATION
+    /** Pool drawing all its memory, for items and bookkeeping alike,
+        from a resource, which must outlive the pool.
+     */
+    explicit PolyPool(PolyPoolMemoryResource* resource)
+        : mSegments(resource)
+        , mSegmentIndex(0, std::hash<std::type_index>(), std::equal_to<std::type_index>(), resource)
+        , mResource(resource)
     {
-        defaultBlockSize; // avoid usage warning
     }
+
+    PolyPool(size_type defaultBlockSize,
+             PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : PolyPool(resource)
+    {
+#ifdef POLYPOOL_REQUIRE_REGISTRATION
+        (void)defaultBlockSize; // avoid usage warning
 #else
-    : mDefaultBlockSize(defaultBlockSize)
+        mDefaultGrowth = defaultBlockSize;
+#endif
+    }
+    /** Same, for literal block sizes: without it, PolyPool(0) would be
+        ambiguous with the resource constructor. Negative sizes are
+        taken as zero.
+     */
+    PolyPool(int defaultBlockSize,
+             PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : PolyPool(size_type(defaultBlockSize > 0 ? defaultBlockSize : 0), resource)
     {
     }
-#endif
 
     // template <typename Child, enable_if_acceptable<Child> = nullptr>
+    /** Copy or move an object into the pool.
+        The object is constructed directly in its slot, free or fresh,
+        and moved from if given an rvalue.
+     */
     template <typename Child>
-    Child* insert(Child&& child)
+    typename std::decay<Child>::type* insert(Child&& child)
     {
-        Child* freeItem = popFreeItem<Child>();
-        if (freeItem)
-        {
-            *freeItem = child;
-            return freeItem;
-        }
-        else
-        {
-            block_list_iterator block = getBlockForNewItem<Child>();
-            auto iter = block->insert(std::forward<Child>(child));
-            return (Child*)(&(*iter));
-        }
+        using Type=typename std::decay<Child>::type;
+        return segment<Type>().emplace(std::forward<Child>(child));
     }
     
     // template <typename Child, typename... Args, enable_if_acceptable<Child> = nullptr>
+    /** Construct an object directly in its slot, free or fresh,
+        perfectly forwarding args to its constructor.
+     */
     template <typename Child, typename... Args>
     Child* emplace(Args&&... args)
     {
-        Child* freeItem = popFreeItem<Child>();
-        if (freeItem)
-        {
-            *freeItem = Child(args...);
-            return freeItem;
-        }
-        else
-        {
-            block_list_iterator block = getBlockForNewItem<Child>();
-            auto iter = block->emplace<Child>(args...);
-            return (Child*)(&(*iter));
-        }
+        return segment<Child>().emplace(std::forward<Args>(args)...);
+    }
+
+    /** Construct count objects from the same arguments.
+
+        Reuses free objects first, then builds the rest block by block
+        in one pass. Much cheaper than count calls to emplace().
+     */
+    template <typename Child, typename... Args>
+    PolyPoolVector<Child*> emplace_n(size_type count, const Args&... args)
+    {
+        return segment<Child>().emplace_n(count, args...);
+    }
+    /** Construct an object from each element of [first, last).
+        See emplace_n() for notes.
+     */
+    template <typename InputIt,
+              typename Child=typename std::iterator_traits<InputIt>::value_type>
+    PolyPoolVector<Child*> insert_range(InputIt first, InputIt last)
+    {
+        return segment<Child>().insert_range(first, last);
     }
 
     /** Add object to free object list.
 
         The object destructor is not called. To both destruct and free
         an object, see destroy().
+
+        The start of the object's storage is reused to link it into
+        the free list, so the object must not be used afterwards.
      */
     template <typename Child>
     void free(Child* item)
     {
-        mFreeItems[typeid(Child)].insert(item);
+        segmentOf(item).freeItem(item);
     }
     /** Call object destructor and add it to free object list.
 
@@ -148,12 +188,71 @@ public:
         It is good practice to set lingering pointers to this object
         to nullptr. To have this done for you along with destruction,
         see nullify().
+
+        Objects of a polymorphic root are filed under their dynamic
+        type, so they may be destroyed through pointers to any of their
+        bases. Other objects must be given through a pointer to their
+        exact type, see PolyPoolFiledType.
      */
     template <typename Child>
     void destroy(Child* item)
     {
-        item->~Child();
-        free(item);
+        segmentOf(item).destroyItem(item);
+    }
+    /** Destroy a range of objects given by pointer.
+
+        Objects are sorted and destructed in address order, and runs of
+        objects of the same type are handed to their segment at once.
+        See destroy() for notes.
+     */
+    template <typename ForwardIt,
+              typename Child=typename std::remove_pointer<
+                  typename std::iterator_traits<ForwardIt>::value_type>::type>
+    void destroy(ForwardIt first, ForwardIt last)
+    {
+        PolyPoolVector<Child*> items(first, last, mResource);
+        std::sort(items.begin(), items.end(), std::less<Child*>());
+        // The type of each item is found through the given pointers,
+        // and its segment is handed the pointers to its root.
+        const PolyPoolVector<Root*> roots(items.begin(), items.end(), mResource);
+        for (size_type run = 0; run < items.size();)
+        {
+            const std::type_info& type = PolyPoolFiledType<Child>::of(items[run]);
+            size_type end = run + 1;
+            while (end < items.size() and PolyPoolFiledType<Child>::of(items[end]) == type)
+            {
+                ++end;
+            }
+            mSegments[mSegmentIndex.at(type)]->destroyItems(
+                roots.data() + run, roots.data() + end);
+            run = end;
+        }
+    }
+    /** Destroy every object for which pred(object) is true.
+
+        pred is called with Root&. Objects are visited type by type in
+        storage order, one sweep per block, so this is much cheaper
+        than destroying objects one by one while iterating.
+
+        Returns the number of objects destroyed.
+     */
+    template <typename Predicate>
+    size_type destroy_if(Predicate&& pred)
+    {
+        const std::function<bool(Root&)> test(std::forward<Predicate>(pred));
+        size_type destroyed = 0;
+        for (auto& segment : mSegments)
+        {
+            destroyed += segment->destroyItemsIf(test);
+        }
+        return destroyed;
+    }
+    /// Destroy every object of a type for which pred(object) is true.
+    template <typename Child, typename Predicate>
+    size_type destroy_if(Predicate&& pred)
+    {
+        auto segment = findSegment<Child>();
+        return segment ? segment->destroy_if(std::forward<Predicate>(pred)) : 0;
     }
     /** Destroy object and set its pointer to nullptr.
         See destroy() for notes.
@@ -165,212 +264,442 @@ public:
         item = nullptr;
     }
 
-    bool empty()
+    /** Keep an object constructed for acquire<Child>() instead of
+        destroying it, so expensive members such as buffers or
+        connections survive. Calls the object's reset() member first,
+        if it has one.
+
+        Like destroy(), objects of a polymorphic root may be given
+        through a pointer to any of their bases; they are kept for
+        acquire() of their dynamic type. std::invalid_argument is
+        thrown if the object is not stored by the pool. A released
+        object is no longer active: iteration skips it and it must not
+        be destroyed. defragment(), shrink_to_fit() and clear() destroy
+        released objects.
+     */
+    template <typename Child>
+    void release(Child* item)
+    {
+        holdingSegment(item).releaseItem(item);
+    }
+    /** The most recently released object of a type, as is, or a new
+        one constructed from args if none is left.
+     */
+    template <typename Child, typename... Args>
+    Child* acquire(Args&&... args)
     {
-        for (auto& block : mBlocks)
+        return segment<Child>().acquire(std::forward<Args>(args)...);
+    }
+    /// Construct count released objects from the same arguments.
+    template <typename Child, typename... Args>
+    void prewarm(size_type count, const Args&... args)
+    {
+        segment<Child>().prewarm(count, args...);
+    }
+
+    /** Get a handle to an item.
+
+        Unlike pointers, handles stay valid when defragment() moves
+        their item, and resolve to nullptr once it is destroyed. See
+        PolyPoolHandle.h.
+
+        Handles are resolved by the type they are issued for, so the
+        item must be held by the segment of Child, rather than of a type
+        deriving from it. std::invalid_argument is thrown otherwise, or
+        if the item is not live: destroyed, freed and released items
+        have no handle.
+     */
+    template <typename Child>
+    Handle<Child> handle(Child* item)
+    {
+        auto segment = findSegment<Child>();
+        if (not segment)
         {
-            if (not block.empty()) return false;
+            throw std::invalid_argument("Object is not stored by this PolyPool as its own type.");
         }
-        return true;
+        return segment->handle(item);
     }
+    /// The item a handle refers to, or nullptr if it is gone.
     template <typename Child>
+    Child* resolve(Handle<Child> handle)
+    {
+        auto segment = findSegment<Child>();
+        return segment ? segment->resolve(handle) : nullptr;
+    }
+
     bool empty()
     {
-        for (auto block = mBlocks.begin(); block <= mLastBlock[typeid(Child)]; block++)
-        {
-            if (not block->empty<Child>()) return false;
-        }
-        return true;
+        return active() == 0;
+    }
+    template <typename Child>
+    bool empty()
+    {
+        return active<Child>() == 0;
     }
 
     /// Number of active items.
     size_type active()
     {
-        return size() - holes();
+        size_type size = 0;
+        for (auto& segment : mSegments)
+        {
+            size += segment->active();
+        }
+        return size;
     }
     template <typename Child>
     size_type active()
     {
-        return size<Child>() - holes<Child>();
+        auto segment = findSegment<Child>();
+        return segment ? segment->active() : 0;
     }
 
     /// Number of free items.
     size_type holes()
     {
         size_type size = 0;
-        for (auto& freeItems : mFreeItems)
+        for (auto& segment : mSegments)
         {
-            size += freeItems.second.size();
+            size += segment->holes();
         }
         return size;
     }
     template <typename Child>
     size_type holes()
     {
-        return mFreeItems[typeid(Child)].size();
+        auto segment = findSegment<Child>();
+        return segment ? segment->holes() : 0;
+    }
+
+    /// Number of released objects of a type, see release().
+    template <typename Child>
+    size_type warm()
+    {
+        auto segment = findSegment<Child>();
+        return segment ? segment->warm() : 0;
     }
 
     /// Number of active + free items.
     size_type size()
     {
         size_type size = 0;
-        for (auto& block : mBlocks)
+        for (auto& segment : mSegments)
         {
-            size += block.size();
+            size += segment->size();
         }
         return size;
     }
     template <typename Child>
     size_type size()
     {
-        size_type size = 0;
-        for (auto block = mBlocks.begin(); block <= mLastBlock[typeid(Child)]; block++)
-        {
-            size += block->template size<Child>();
-        }
-        return size;
+        auto segment = findSegment<Child>();
+        return segment ? segment->size() : 0;
     }
 
     /// Total number of items, active + free + spare.
     size_type capacity()
     {
         size_type size = 0;
-        for (auto& block : mBlocks)
+        for (auto& segment : mSegments)
         {
-            size += block.capacity();
+            size += segment->capacity();
         }
         return size;
     }
     template <typename Child>
     size_type capacity()
+    {
+        auto segment = findSegment<Child>();
+        return segment ? segment->capacity() : 0;
+    }
+
+    /// Number of blocks.
+    size_type blocks()
     {
         size_type size = 0;
-        for (auto block = mBlocks.begin(); block <= mLastBlock[typeid(Child)]; block++)
+        for (auto& segment : mSegments)
         {
-            size += block->template capacity<Child>();
+            size += segment->blocks();
         }
         return size;
     }
+    template <typename Child>
+    size_type blocks()
+    {
+        auto segment = findSegment<Child>();
+        return segment ? segment->blocks() : 0;
+    }
 
-    ///TODO: Number of blocks.
-    /// size_type blocks()
+    /** Snapshot of the counters of all types, see PolyPoolStats.
+        Costs a few additions per type. Types dropped by clear() no
+        longer count.
+     */
+    PolyPoolStats stats()
+    {
+        PolyPoolStats stats;
+        for (auto& segment : mSegments)
+        {
+            stats += segment->stats();
+        }
+        return stats;
+    }
+    template <typename Child>
+    PolyPoolStats stats()
+    {
+        auto segment = findSegment<Child>();
+        return segment ? segment->stats() : PolyPoolStats();
+    }
 
     //todo: size_type max_size()
 
-    /** Set the block size for a type and apply to existing blocks.
-        Does not cause rellocation of existing blocks.
-     */
-    // template <typename Child>
-    // void setBlockSize(size_type size)
-    // {
-    //     setDefaultBlockSize<Child>(size);
-    //     for (auto& container : mBlocks)
-    //     {
-    //         container.reserve(typeid(Child), size);
-    //     }
-    // }
     /** Set the default block size for newly created blocks.
         No-op if POLYPOOL_REQUIRE_REGISTRATION is enabled.
      */
     template <typename Child>
     void setDefaultBlockSize(size_type size)
     {
-        mBlockSize[typeid(Child)] = size;
-        registerType<Child>();
+        auto segment = findSegment<Child>();
+        if (segment)
+        {
+            segment->setBlockSize(size);
+        }
+        else
+        {
+            registerType<Child>(size);
+        }
     }
     void setDefaultBlockSize(size_type size)
     {
 #ifdef POLYPOOL_REQUIRE_REGISTRATION
         size; // avoid usage warning
 #else
-        mDefaultBlockSize = size;
+        mDefaultGrowth = size;
 #endif
     }
 
-    /** Destruct and free all objects in container without
-        deallocating memory.
+    /** Choose the capacity of a type's new blocks by a growth policy,
+        such as PolyPoolGrowth::geometric(). Registers the type, like
+        setDefaultBlockSize<Child>().
      */
-    void freeAll()
+    template <typename Child>
+    void setGrowth(PolyPoolGrowth growth)
     {
-        for (auto& item : *this)
+        auto segment = findSegment<Child>();
+        if (segment)
         {
-            destroy(&item);
+            segment->setGrowth(std::move(growth));
         }
-        for (auto& lastBlock : mLastBlock)
+        else
         {
-            lastBlock = mBlocks.begin();
+            registerType<Child>(std::move(growth));
         }
     }
+    /** Set the growth policy of types registered from now on.
+        No-op if POLYPOOL_REQUIRE_REGISTRATION is enabled.
+     */
+    void setDefaultGrowth(PolyPoolGrowth growth)
+    {
+#ifdef POLYPOOL_REQUIRE_REGISTRATION
+        (void)growth; // avoid usage warning
+#else
+        mDefaultGrowth = std::move(growth);
+#endif
+    }
+
+    /** Choose which free slots new items of a type go to, such as
+        PolyPoolReuse::lowestSlot to keep them packed at the front.
+        Registers the type unless POLYPOOL_REQUIRE_REGISTRATION is
+        enabled.
+     */
+    template <typename Child>
+    void setReuse(PolyPoolReuse reuse)
+    {
+        segment<Child>().setReuse(reuse);
+    }
+
+    /** Draw the blocks of a type from a resource of its own, such as a
+        PolyPoolMappedResource, while bookkeeping stays with the pool's
+        resource. Registers the type unless POLYPOOL_REQUIRE_REGISTRATION
+        is enabled. Must be called before any object of the type is
+        added, else std::logic_error is thrown.
+     */
     template <typename Child>
+    void setBlockResource(PolyPoolMemoryResource* resource)
+    {
+        segment<Child>().setBlockResource(resource);
+    }
+
+    /** Destruct and free all objects in container without
+        deallocating memory.
+     */
     void freeAll()
     {
-        for (auto& item : local<Child>())
+        for (auto& segment : mSegments)
         {
-            destroy(&item);
+            segment->freeAll();
         }
-        mLastBlock[typeid(Child)] = mBlocks.begin();
+    }
+    template <typename Child>
+    void freeAll()
+    {
+        auto segment = findSegment<Child>();
+        if (segment) segment->freeAll();
     }
 
-    /** Destruct all objects in container and unregister all types.
-        May not deallocate memory depending on std::vector
-        implementation.
+    /** Destruct all objects in container, deallocate their blocks and
+        unregister all types.
      */
     void clear()
     {
-        //FIXME: This may call destruction on already destroyed free objects.
-        mBlocks.clear();
-        mFreeItems.clear();
-        mLastBlock.clear();
-        mBlockSize.clear();
+        mSegments.clear();
+        mSegmentIndex.clear();
     }
-    /** Destruct all objects of given type in container and unregister
-        the type.
-        May not deallocate memory depending on std::vector
-        implementation.
+    /** Destruct all objects of given type in container, deallocate
+        their blocks and unregister the type.
      */
     template <typename Child>
     void clear()
     {
-        const auto& childID = typeid(Child);
-        for (auto block = mBlocks.begin();
-             block <= mLastBlock[childID]; block++)
+        auto index = mSegmentIndex.find(typeid(Child));
+        if (index == mSegmentIndex.end()) return;
+
+        const size_type erased = index->second;
+        mSegments.erase(mSegments.begin() + erased);
+        mSegmentIndex.erase(index);
+        for (auto& other : mSegmentIndex)
         {
-            //FIXME: This may call destruction on already destroyed free objects.
-            block->clear<Child>();
+            if (other.second > erased) --other.second;
         }
-        mFreeItems.erase(childID);
-        mLastBlock.erase(childID);
-        mBlockSize.erase(childID);
+    }
+
+    /** Call f on every active object, with Root&.
+
+        Unlike iterating, objects are visited segment by segment
+        without per-object bookkeeping. Calls on objects still go
+        through virtual dispatch. For static types, see
+        for_each<Child, ...>().
+     */
+    template <typename F>
+    void for_each(F&& f)
+    {
+        for (auto& segment : mSegments)
+        {
+            segment->forEachRoot(f);
+        }
+    }
+    /** Call f on every active object.
+
+        f is called with Child& for objects of the listed types, over
+        runs of consecutive objects, so the compiler can inline and
+        vectorize the calls. Objects of all other types are passed as
+        Root&, falling back to virtual dispatch.
+     */
+    template <typename Child, typename... Listed, typename F>
+    void for_each(F&& f)
+    {
+        PolyPoolBitmap listed(mSegments.size(), mResource);
+        forEachListed<Child, Listed...>(f, listed);
+        for (size_type segment = 0; segment < mSegments.size(); segment++)
+        {
+            if (not listed.test(segment)) mSegments[segment]->forEachRoot(f);
+        }
+    }
+
+    /** Call f on every active object, with Root&, from several
+        threads at once.
+
+        The objects are split into ranges of consecutive slots, which
+        are run as tasks on a work-stealing executor. The calling
+        thread takes part. f must be safe to call concurrently, and the
+        pool must not be modified until this returns. Nested calls, from
+        within f or any other executor task, run on the calling thread
+        alone rather than waiting for the executor.
+     */
+    template <typename F>
+    void parallel_for_each(F&& f, PolyPoolExecutor& executor = PolyPoolExecutor::shared())
+    {
+        PolyPoolExecutor::task_list tasks(mResource);
+        for (auto& segment : mSegments)
+        {
+            segment->parallelRootTasks(f, tasks);
+        }
+        executor.run(tasks);
+    }
+    /** Call f on every active object from several threads at once.
+        Objects of the listed types are passed by static type, as with
+        for_each<Child, ...>(). See parallel_for_each() for notes.
+     */
+    template <typename Child, typename... Listed, typename F>
+    void parallel_for_each(F&& f, PolyPoolExecutor& executor = PolyPoolExecutor::shared())
+    {
+        PolyPoolBitmap listed(mSegments.size(), mResource);
+        PolyPoolExecutor::task_list tasks(mResource);
+        parallelTasksListed<Child, Listed...>(f, listed, tasks);
+        for (size_type segment = 0; segment < mSegments.size(); segment++)
+        {
+            if (not listed.test(segment)) mSegments[segment]->parallelRootTasks(f, tasks);
+        }
+        executor.run(tasks);
     }
 
     PolyPoolIterator<Root> begin()
     {
-        base_collection_iterator begin = mBlocks[0].begin();
-        return PolyPoolIterator<Root>(
-            begin, mBlocks.begin(), mBlocks, mFreeItems);
+        PolyPoolIterator<Root> iter(&mSegments, 0);
+        iter.seekActive();
+        return iter;
     }
     PolyPoolIterator<Root> end()
     {
-        base_collection_iterator sentinel = mBlocks.end()->end();
-        return PolyPoolIterator<Root>(
-            sentinel, mBlocks.end() - 1, mBlocks, mFreeItems);
+        return PolyPoolIterator<Root>(&mSegments, mSegments.size());
+    }
+    std::reverse_iterator<PolyPoolIterator<Root> > rbegin()
+    {
+        return std::reverse_iterator<PolyPoolIterator<Root> >(end());
+    }
+    std::reverse_iterator<PolyPoolIterator<Root> > rend()
+    {
+        return std::reverse_iterator<PolyPoolIterator<Root> >(begin());
     }
 
     template <typename Child>
     PolyPoolLocalIterator<Child, Root> begin()
     {
-        auto& lastBlock = mLastBlock[typeid(Child)];
-        auto begin = mBlocks[0].template begin<Child>();
-        return PolyPoolLocalIterator<Child, Root>(
-            begin, mBlocks.begin(), lastBlock, mBlocks, mFreeItems[typeid(Child)]);
+        return segment<Child>().begin();
     }
     template <typename Child>
     PolyPoolLocalIterator<Child, Root> end()
     {
-        auto& lastBlock = mLastBlock[typeid(Child)];
-        auto sentinel = lastBlock->template end<Child>();
-        return PolyPoolLocalIterator<Child, Root>(
-            sentinel, lastBlock, lastBlock, mBlocks, mFreeItems[typeid(Child)]);
+        return segment<Child>().end();
+    }
+    template <typename Child>
+    std::reverse_iterator<PolyPoolLocalIterator<Child, Root> > rbegin()
+    {
+        return std::reverse_iterator<PolyPoolLocalIterator<Child, Root> >(end<Child>());
+    }
+    template <typename Child>
+    std::reverse_iterator<PolyPoolLocalIterator<Child, Root> > rend()
+    {
+        return std::reverse_iterator<PolyPoolLocalIterator<Child, Root> >(begin<Child>());
+    }
+
+    /** The blocks holding items of a type, each as a contiguous array
+        of Child plus the bitmap of its live slots, for loops that
+        want raw pointers rather than iterators:
+
+            for (auto block : pool.segments<Particle>())
+            {
+                block.forEachRun([](Particle* first, std::size_t count)
+                {
+                    for (std::size_t i = 0; i < count; i++) first[i].x += first[i].vx;
+                });
+            }
+
+        Requires a layout without padding between items.
+     */
+    template <typename Child>
+    PolyPoolBlocks<Child, Root> segments()
+    {
+        return PolyPoolBlocks<Child, Root>(&segment<Child>());
     }
 
 
@@ -397,43 +726,76 @@ public:
         return Local<Child>(this);
     }
 
-    /** TODO: Deallocate empty blocks from the last non-empty block to
-        the end of the block list.
-
-        Note that empty blocks prior to the last non-empty block will
-        not be preserved.
+    /** Deallocate empty blocks.
 
         Empty blocks = blocks with only free objects. Empty blocks are
         created when all the objects in the block have been freed.
+
+        Free objects in the remaining blocks are kept, so call
+        defragment() first to empty out sparsely used blocks.
      */
     void shrink_to_fit()
     {
+        for (auto& segment : mSegments)
+        {
+            segment->shrink_to_fit();
+        }
     }
     template <typename Child>
     void shrink_to_fit()
     {
+        auto segment = findSegment<Child>();
+        if (segment) segment->shrink_to_fit();
     }
 
-    /**TODO: Move active objects until they are contiguous in memory.
+    /** Move active objects until they are contiguous in memory.
 
-       Reduces memory fragmentation by moving active objects into
-       'holes' left by freed objects.
+        Reduces memory fragmentation by moving active objects into
+        'holes' left by freed objects. Objects are moved with their
+        move constructor, and the holes left behind become spare
+        capacity. Types that cannot be move constructed are skipped.
 
-       If calling shrink_to_fit(), call it after defragment() since
-       defragmentation may create separate nodes.
+        relocate(old, new) is called with Root pointers for every
+        object moved, once it has been constructed at its new address
+        and before the old object is destructed. Use it to patch
+        references to moved objects.
 
-       WARNING: This can be an expensive operation if there are many
-       'holes'.
+        If calling shrink_to_fit(), call it after defragment() since
+        defragmentation may leave trailing blocks empty.
 
-       WARNING: Since some objects are moved, this will invalidate
-       some pointers.
+        WARNING: This can be an expensive operation if there are many
+        'holes'.
+
+        WARNING: Since some objects are moved, this will invalidate
+        some pointers.
     */
+    template <typename F>
+    void defragment(F&& relocate)
+    {
+        const std::function<void(Root*, Root*)> hook(std::forward<F>(relocate));
+        for (auto& segment : mSegments)
+        {
+            segment->defragmentItems(hook);
+        }
+    }
     void defragment()
     {
+        defragment(std::function<void(Root*, Root*)>());
+    }
+    /** Defragment objects of a single type.
+        relocate(old, new) is called with Child pointers.
+     */
+    template <typename Child, typename F>
+    void defragment(F&& relocate)
+    {
+        auto segment = findSegment<Child>();
+        if (segment) segment->defragment(std::forward<F>(relocate));
     }
     template <typename Child>
     void defragment()
     {
+        auto segment = findSegment<Child>();
+        if (segment) segment->defragment();
     }
 
     /** Make active objects contiguous and deallocate empty blocks.
@@ -452,95 +814,164 @@ public:
         shrink_to_fit<Child>();
     }
 
-protected:
-    /// The underlying polymorphic block containers.
-    std::vector<boost::base_collection<Root> > mBlocks;
-    // std::unordered_map<std::type_index, std::unique_ptr<PolyPoolSegment> > mBlocks;
-
-    /// The size of each block per type.
-    std::unordered_map<std::type_index, size_type> mBlockSize;
-    /// The current block being filled for a specific type.
-    std::unordered_map<std::type_index, block_list_iterator> mLastBlock;
-    /// Tracks free items of every type.
-    std::unordered_map<std::type_index, std::unordered_set<Root*> > mFreeItems;
+    /** Write all objects to a snapshot file, for load() to restore.
 
-#ifndef POLYPOOL_REQUIRE_REGISTRATION
-    /// Default block size used for unregistered types.
-    size_type mDefaultBlockSize = 20;
-#endif
+        Each type's blocks are written as they are, with their live
+        bitmaps. Trivially copyable types are written as raw bytes;
+        other types must opt in through PolyPoolSnapshot<Child>, or
+        saving throws std::logic_error. Released objects are not
+        saved. Throws std::runtime_error on I/O errors; the previous
+        file, if any, is then left untouched.
 
-    template <typename Child>
-    Child* popFreeItem()
+        Types are identified by their RTTI names, so snapshots are
+        only good for restarts of the same build.
+     */
+    void save(const std::string& path)
     {
-        auto& freeItems = mFreeItems[typeid(Child)];
-        if (not freeItems.empty())
+        PolyPoolSnapshotWriter out(path, mSegments.size());
+        for (const auto& entry : mSegmentIndex)
         {
-            auto iter = freeItems.begin();
-            Child* item = (Child*)(*iter);
-            freeItems.erase(iter);
-            return item;
+            out.writeString(entry.first.name());
+            mSegments[entry.second]->saveItems(out);
         }
-        else
+        out.close();
+    }
+    /** Restore objects written by save().
+
+        Every type in the snapshot must already be registered with the
+        pool, by setDefaultBlockSize<Child>() for instance, and hold no
+        blocks. Blocks of trivially copyable types are used in place
+        from the memory-mapped file, so loading costs no more than
+        reading the file, page by page as objects are first touched.
+        Objects of other types are constructed by their
+        PolyPoolSnapshot<Child>::load().
+
+        Throws std::runtime_error if the file cannot be read, is
+        malformed or holds an unregistered type, and std::logic_error
+        if a type cannot be loaded or already holds blocks. Types
+        loaded before the error keep their objects.
+     */
+    void load(const std::string& path)
+    {
+        auto in = std::make_shared<PolyPoolSnapshotFile>(path);
+        const size_type segments = in->readHeader();
+        for (size_type loaded = 0; loaded < segments; loaded++)
         {
-            return nullptr;
+            const std::string name = in->readString();
+            auto entry = mSegmentIndex.begin();
+            while (entry != mSegmentIndex.end() and name != entry->first.name())
+            {
+                ++entry;
+            }
+            if (entry == mSegmentIndex.end())
+            {
+                throw std::runtime_error("Snapshot holds unregistered type " + name);
+            }
+            mSegments[entry->second]->loadItems(in);
         }
     }
 
-    /** Get a block with room for a new item.
-        May create a block if all current blocks are occupied.
+protected:
+    /// One segment per registered type, in registration order.
+    segment_list mSegments;
+    /// Index of each registered type's segment.
+    std::unordered_map<std::type_index, size_type,
+                       std::hash<std::type_index>, std::equal_to<std::type_index>,
+                       PolyPoolAllocator<std::pair<const std::type_index, size_type> > > mSegmentIndex;
+    PolyPoolMemoryResource* mResource;
+
+#ifndef POLYPOOL_REQUIRE_REGISTRATION
+    /// Growth policy used for unregistered types.
+    PolyPoolGrowth mDefaultGrowth;
+#endif
+
+    /// Segment of a type, or nullptr if the type is unregistered.
+    template <typename Child>
+    PolyPoolSegment<Child, Root>* findSegment()
+    {
+        auto index = mSegmentIndex.find(typeid(Child));
+        if (index == mSegmentIndex.end()) return nullptr;
+        return static_cast<PolyPoolSegment<Child, Root>*>(mSegments[index->second].get());
+    }
+
+    /** Segment to add items of a type to.
+        Registers the type unless POLYPOOL_REQUIRE_REGISTRATION is
+        enabled.
      */
     template <typename Child>
-    block_list_iterator getBlockForNewItem()
+    PolyPoolSegment<Child, Root>& segment()
     {
-        const std::type_info& childID = typeid(Child);
+        auto segment = findSegment<Child>();
+        if (segment) return *segment;
 #ifdef POLYPOOL_REQUIRE_REGISTRATION
-        if (mLastBlock.count(childID) == 0)
-        {
-            throw std::logic_error("Cannot add unregistered type to PolyPool while POLYPOOL_REQUIRE_REGISTRATION is enabled.");
-        }
+        throw std::logic_error("Cannot add unregistered type to PolyPool while POLYPOOL_REQUIRE_REGISTRATION is enabled.");
 #else
-        registerType<Child>(mDefaultBlockSize);
+        return registerType<Child>(mDefaultGrowth);
 #endif
-        auto& lastBlock = mLastBlock[childID];
-        if (lastBlock->size(childID) == lastBlock->capacity(childID))
+    }
+
+    template <typename F>
+    void forEachListed(F&, PolyPoolBitmap&)
+    {
+    }
+    template <typename Child, typename... Listed, typename F>
+    void forEachListed(F& f, PolyPoolBitmap& listed)
+    {
+        auto index = mSegmentIndex.find(typeid(Child));
+        if (index != mSegmentIndex.end() and not listed.test(index->second))
         {
-            if (lastBlock == mBlocks.end() - 1)
-            {
-                // Create new block.
-                mBlocks.emplace_back();
-                lastBlock = mBlocks.end() - 1;
-            }
-            else
-            {
-                // Move to next block.
-                lastBlock++;
-            }
-            lastBlock->template reserve<Child>(mBlockSize[childID]);
+            listed.set(index->second);
+            static_cast<PolyPoolSegment<Child, Root>&>(*mSegments[index->second]).for_each(f);
         }
-        return lastBlock;
+        forEachListed<Listed...>(f, listed);
     }
 
-    template <typename Type>
-    void registerType(const size_type& blockSize)
+    template <typename F>
+    void parallelTasksListed(F&, PolyPoolBitmap&, PolyPoolExecutor::task_list&)
+    {
+    }
+    template <typename Child, typename... Listed, typename F>
+    void parallelTasksListed(F& f, PolyPoolBitmap& listed,
+                             PolyPoolExecutor::task_list& tasks)
     {
-        const std::type_info& type = typeid(Type);
-        if (mLastBlock.count(type) == 0)
+        auto index = mSegmentIndex.find(typeid(Child));
+        if (index != mSegmentIndex.end() and not listed.test(index->second))
         {
-            mLastBlock[type] = mBlocks.begin();
-            mBlockSize[type] = blockSize;
-            mLastBlock[type]->template reserve<Type>(mBlockSize[type]);
+            listed.set(index->second);
+            static_cast<PolyPoolSegment<Child, Root>&>(*mSegments[index->second]).parallelTasks(f, tasks);
         }
+        parallelTasksListed<Listed...>(f, listed, tasks);
     }
-    template <typename Type>
-    void registerType()
+
+    /// Segment holding an item, found by the type it is filed under.
+    template <typename Child>
+    PolyPoolSegmentBase<Root>& segmentOf(Child* item)
     {
-        const std::type_info& type = typeid(Type);
-        if (mLastBlock.count(type) == 0)
+        return *mSegments[mSegmentIndex.at(PolyPoolFiledType<Child>::of(item))];
+    }
+    /** Like segmentOf(), but throws std::invalid_argument unless the
+        segment holds the item.
+     */
+    template <typename Child>
+    PolyPoolSegmentBase<Root>& holdingSegment(Child* item)
+    {
+        auto index = mSegmentIndex.find(PolyPoolFiledType<Child>::of(item));
+        if (index == mSegmentIndex.end() or not mSegments[index->second]->contains(item))
         {
-            // Register type.
-            mLastBlock[type] = mBlocks.begin();
-            mLastBlock[type]->template reserve<Type>(mBlockSize[type]);
+            throw std::invalid_argument("Object is not stored by this PolyPool.");
         }
+        return *mSegments[index->second];
+    }
+
+    template <typename Type>
+    PolyPoolSegment<Type, Root>& registerType(PolyPoolGrowth growth)
+    {
+        auto segment = mResource->create<PolyPoolSegmentBase<Root>, PolyPoolSegment<Type, Root> >(
+            std::move(growth), mResource);
+        auto& registered = static_cast<PolyPoolSegment<Type, Root>&>(*segment);
+        mSegments.push_back(std::move(segment));
+        mSegmentIndex[typeid(Type)] = mSegments.size() - 1;
+        return registered;
     }
 
 private:
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "PolyPoolMemory.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/** Growable bitmap with fast scans for set bits.
+
+    Used to mark the live slots of a block segment. Iterators find the
+    next live slot with a count-trailing-zeros scan, skipping whole
+    runs of free slots a word at a time rather than testing each slot.
+ */
+class PolyPoolBitmap
+{
+public:
+    using size_type=std::size_t;
+    using word_type=std::uint64_t;
+
+    static const size_type word_bits = 64;
+
+    PolyPoolBitmap() = default;
+    /// Construct with size bits, all unset.
+    explicit PolyPoolBitmap(size_type size,
+                            PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : mWords((size + word_bits - 1) / word_bits, 0, resource)
+        , mSize(size)
+    {
+    }
+
+    void push_back(bool value)
+    {
+        if (mSize % word_bits == 0)
+        {
+            mWords.push_back(0);
+        }
+        ++mSize;
+        if (value) set(mSize - 1);
+    }
+
+    void set(size_type pos)
+    {
+        mWords[pos / word_bits] |= word_type(1) << (pos % word_bits);
+    }
+    void reset(size_type pos)
+    {
+        mWords[pos / word_bits] &= ~(word_type(1) << (pos % word_bits));
+    }
+    /// Set all bits in [first, last).
+    void set(size_type first, size_type last)
+    {
+        while (first < last)
+        {
+            const size_type offset = first % word_bits;
+            const size_type count = std::min(word_bits - offset, last - first);
+            const word_type mask = count == word_bits
+                ? ~word_type(0)
+                : ((word_type(1) << count) - 1) << offset;
+            mWords[first / word_bits] |= mask;
+            first += count;
+        }
+    }
+    bool test(size_type pos) const
+    {
+        return (mWords[pos / word_bits] >> (pos % word_bits)) & 1;
+    }
+
+    /** The words holding the bits, lowest bits first, for copying
+        bitmaps wholesale. Bits past size() must stay unset.
+     */
+    word_type* data()
+    {
+        return mWords.data();
+    }
+    const word_type* data() const
+    {
+        return mWords.data();
+    }
+
+    /// Number of bits, set or not.
+    size_type size() const
+    {
+        return mSize;
+    }
+    bool empty() const
+    {
+        return mSize == 0;
+    }
+
+    /// Position of the first set bit at or after pos, or size() if none.
+    size_type findNext(size_type pos) const
+    {
+        if (pos >= mSize) return mSize;
+        size_type word = pos / word_bits;
+        word_type bits = mWords[word] & (~word_type(0) << (pos % word_bits));
+        while (not bits)
+        {
+            if (++word == mWords.size()) return mSize;
+            bits = mWords[word];
+        }
+        // Bits past mSize are never set, so no need to clamp.
+        return word * word_bits + countTrailingZeros(bits);
+    }
+
+    /// Position of the first unset bit at or after pos, or size() if none.
+    size_type findNextUnset(size_type pos) const
+    {
+        if (pos >= mSize) return mSize;
+        size_type word = pos / word_bits;
+        word_type bits = ~mWords[word] & (~word_type(0) << (pos % word_bits));
+        while (not bits)
+        {
+            if (++word == mWords.size()) return mSize;
+            bits = ~mWords[word];
+        }
+        // Bits past mSize read as unset, so clamp.
+        const size_type next = word * word_bits + countTrailingZeros(bits);
+        return next < mSize ? next : mSize;
+    }
+
+    /// Position of the last set bit before pos, or size() if none.
+    size_type findPrev(size_type pos) const
+    {
+        if (pos > mSize) pos = mSize;
+        if (pos == 0) return mSize;
+        size_type word = (pos - 1) / word_bits;
+        word_type bits = mWords[word] & (~word_type(0) >> (word_bits - 1 - (pos - 1) % word_bits));
+        while (not bits)
+        {
+            if (word == 0) return mSize;
+            bits = mWords[--word];
+        }
+        return word * word_bits + word_bits - 1 - countLeadingZeros(bits);
+    }
+
+    /// Index of the lowest set bit of a non-zero word.
+    static size_type countTrailingZeros(word_type bits)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+        return index;
+#else
+        return __builtin_ctzll(bits);
+#endif
+    }
+
+    /// Number of unset bits above the highest set bit of a non-zero word.
+    static size_type countLeadingZeros(word_type bits)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse64(&index, bits);
+        return word_bits - 1 - index;
+#else
+        return __builtin_clzll(bits);
+#endif
+    }
+
+private:
+    PolyPoolVector<word_type> mWords;
+    size_type mSize = 0;
+};
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "PolyPoolMemory.h"
+
+/** Finds the block holding an address in constant time.
+
+    Memory is cut into chunks of a power of two bytes, no larger than
+    the smallest block, so that each chunk overlaps at most two
+    blocks. A hash table with open addressing maps every chunk a block
+    overlaps to the block's index, and a lookup checks the address
+    against the ranges of the one or two blocks of its chunk.
+
+    Blocks are numbered in the order they are added. Adding a block
+    smaller than the chunk size shrinks the chunks and rebuilds the
+    table, as does clear() followed by adding the remaining blocks.
+    Blocks much larger than the smallest one take an entry per chunk,
+    so the table grows with the total storage rather than the number
+    of blocks.
+ */
+class PolyPoolBlockMap
+{
+public:
+    using size_type=std::size_t;
+
+    /// Returned by find() for addresses outside every block.
+    static const size_type none = ~size_type(0);
+
+    explicit PolyPoolBlockMap(PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : mRanges(resource)
+        , mEntries(resource)
+    {
+    }
+
+    /// Add the block [data, data + bytes) under index size().
+    void push_back(const void* data, size_type bytes)
+    {
+        const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(data);
+        mRanges.push_back(Range{first, first + bytes});
+        if (mRanges.size() == 1 or bytes < (std::uintptr_t(1) << mShift))
+        {
+            mShift = 0;
+            while (bytes >> (mShift + 1)) ++mShift;
+            rehash(mEntries.size());
+            return;
+        }
+        if ((mUsed + chunks(mRanges.back())) * 2 > mEntries.size())
+        {
+            rehash(mEntries.size() * 2);
+            return;
+        }
+        insert(mRanges.size() - 1);
+    }
+
+    /// Index of the block holding an address, or none.
+    size_type find(const void* address) const
+    {
+        if (mEntries.empty()) return none;
+        const std::uintptr_t at = reinterpret_cast<std::uintptr_t>(address);
+        const std::uintptr_t chunk = at >> mShift;
+        for (size_type entry = bucket(chunk);; entry = (entry + 1) & (mEntries.size() - 1))
+        {
+            const Entry& current = mEntries[entry];
+            if (current.chunk == chunk)
+            {
+                for (index_type block : current.blocks)
+                {
+                    if (block != noBlock and at >= mRanges[block].first and at < mRanges[block].last)
+                    {
+                        return block;
+                    }
+                }
+                return none;
+            }
+            if (current.blocks[0] == noBlock) return none;
+        }
+    }
+
+    /// Number of blocks added.
+    size_type size() const
+    {
+        return mRanges.size();
+    }
+
+    /// Forget all blocks.
+    void clear()
+    {
+        mRanges.clear();
+        mEntries.clear();
+        mUsed = 0;
+    }
+
+private:
+    using index_type=std::uint32_t;
+
+    static const index_type noBlock = ~index_type(0);
+
+    struct Range
+    {
+        std::uintptr_t first;
+        std::uintptr_t last;
+    };
+    /// The blocks overlapping a chunk. Free entries have no blocks.
+    struct Entry
+    {
+        std::uintptr_t chunk;
+        index_type blocks[2];
+    };
+
+    size_type chunks(const Range& range) const
+    {
+        return ((range.last - 1) >> mShift) - (range.first >> mShift) + 1;
+    }
+    size_type bucket(std::uintptr_t chunk) const
+    {
+        // Fibonacci hashing, taking the high bits of the product.
+        const std::uint64_t hash = std::uint64_t(chunk) * 0x9E3779B97F4A7C15ull;
+        return size_type(hash >> (64 - mBits));
+    }
+
+    /// Enter block into every chunk it overlaps.
+    void insert(size_type block)
+    {
+        const Range& range = mRanges[block];
+        for (std::uintptr_t chunk = range.first >> mShift; chunk <= (range.last - 1) >> mShift; ++chunk)
+        {
+            size_type entry = bucket(chunk);
+            while (mEntries[entry].blocks[0] != noBlock and mEntries[entry].chunk != chunk)
+            {
+                entry = (entry + 1) & (mEntries.size() - 1);
+            }
+            Entry& current = mEntries[entry];
+            if (current.blocks[0] == noBlock)
+            {
+                current.chunk = chunk;
+                current.blocks[0] = index_type(block);
+                ++mUsed;
+            }
+            else
+            {
+                current.blocks[1] = index_type(block);
+            }
+        }
+    }
+
+    /// Rebuild the table with room for at least entries, keeping it
+    /// at most half full.
+    void rehash(size_type entries)
+    {
+        size_type needed = 0;
+        for (const Range& range : mRanges)
+        {
+            needed += chunks(range);
+        }
+        mBits = 4;
+        while ((size_type(1) << mBits) < entries or (size_type(1) << mBits) < needed * 2)
+        {
+            ++mBits;
+        }
+        mEntries.assign(size_type(1) << mBits, Entry{0, {noBlock, noBlock}});
+        mUsed = 0;
+        for (size_type block = 0; block < mRanges.size(); block++)
+        {
+            insert(block);
+        }
+    }
+
+    PolyPoolVector<Range> mRanges;
+    PolyPoolVector<Entry> mEntries;
+    /// Entries holding a chunk.
+    size_type mUsed = 0;
+    /// log2 of the chunk size, and of the number of entries.
+    size_type mShift = 0;
+    size_type mBits = 0;
+};
+
+
+/** Finds the owner of the block holding an address, readable without
+    locking while one writer adds blocks.
+
+    Works as PolyPoolBlockMap, but maps addresses to an owner given
+    with each block, and entries are only ever added. An entry is
+    filled in before its count of blocks is stored with release, and
+    a rebuilt table is published as a whole, so a reader finds every
+    block added before it synchronized with the writer.
+
+    Replaced tables are kept for readers still probing them until
+    reclaim(). Tables are rebuilt at four times the entries needed,
+    so that the tables kept take space linear in the entries.
+ */
+template <typename Owner>
+class PolyPoolOwnerMap
+{
+public:
+    using size_type=std::size_t;
+
+    explicit PolyPoolOwnerMap(PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : mRanges(resource)
+        , mTables(resource)
+        , mResource(resource)
+    {
+    }
+    PolyPoolOwnerMap(const PolyPoolOwnerMap&) = delete;
+    PolyPoolOwnerMap& operator=(const PolyPoolOwnerMap&) = delete;
+
+    /// Add the block [data, data + bytes), owned by owner. Writer only.
+    void push_back(const void* data, size_type bytes, Owner* owner)
+    {
+        const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(data);
+        mRanges.push_back(Range{first, first + bytes, owner});
+        Table* table = mTable.load(std::memory_order_relaxed);
+        if (not table or bytes < (std::uintptr_t(1) << table->shift)
+            or (mUsed + chunks(mRanges.back(), table->shift)) * 2 > table->size)
+        {
+            rebuild();
+            return;
+        }
+        insert(*table, mRanges.back());
+    }
+
+    /// Owner of the block holding an address, or nullptr.
+    Owner* find(const void* address) const
+    {
+        const Table* table = mTable.load(std::memory_order_acquire);
+        if (not table) return nullptr;
+        const std::uintptr_t at = reinterpret_cast<std::uintptr_t>(address);
+        const std::uintptr_t chunk = at >> table->shift;
+        for (size_type entry = bucket(chunk, table->bits);; entry = (entry + 1) & (table->size - 1))
+        {
+            const Entry& current = table->entries[entry];
+            const size_type count = current.count.load(std::memory_order_acquire);
+            if (count == 0) return nullptr;
+            if (current.chunk == chunk)
+            {
+                for (size_type block = 0; block < count; block++)
+                {
+                    const Range& range = current.ranges[block];
+                    if (at >= range.first and at < range.last) return range.owner;
+                }
+                return nullptr;
+            }
+        }
+    }
+
+    /// Forget all blocks. Only while no reader is running.
+    void clear()
+    {
+        mRanges.clear();
+        mTable.store(nullptr, std::memory_order_release);
+        mTables.clear();
+        mUsed = 0;
+    }
+
+    /// Free replaced tables. Only while no reader is running.
+    void reclaim()
+    {
+        if (mTables.size() > 1) mTables.erase(mTables.begin(), mTables.end() - 1);
+    }
+
+private:
+    struct Range
+    {
+        std::uintptr_t first;
+        std::uintptr_t last;
+        Owner* owner;
+    };
+    /// The blocks overlapping a chunk. Free entries have none.
+    struct Entry
+    {
+        std::atomic<size_type> count{0};
+        std::uintptr_t chunk = 0;
+        Range ranges[2];
+    };
+    struct Table
+    {
+        Table(size_type bits, size_type shift, PolyPoolMemoryResource* resource)
+            : bits(bits)
+            , shift(shift)
+            , size(size_type(1) << bits)
+            , resource(resource)
+        {
+            entries = static_cast<Entry*>(resource->allocate(size * sizeof(Entry), alignof(Entry)));
+            for (size_type entry = 0; entry < size; entry++)
+            {
+                new (entries + entry) Entry();
+            }
+        }
+        Table(const Table&) = delete;
+        Table& operator=(const Table&) = delete;
+        ~Table()
+        {
+            resource->deallocate(entries, size * sizeof(Entry), alignof(Entry));
+        }
+
+        size_type bits;
+        /// log2 of the chunk size.
+        size_type shift;
+        size_type size;
+        PolyPoolMemoryResource* resource;
+        Entry* entries;
+    };
+
+    static size_type chunks(const Range& range, size_type shift)
+    {
+        return ((range.last - 1) >> shift) - (range.first >> shift) + 1;
+    }
+    static size_type bucket(std::uintptr_t chunk, size_type bits)
+    {
+        // Fibonacci hashing, taking the high bits of the product.
+        const std::uint64_t hash = std::uint64_t(chunk) * 0x9E3779B97F4A7C15ull;
+        return size_type(hash >> (64 - bits));
+    }
+
+    /// Enter a block into every chunk it overlaps.
+    void insert(Table& table, const Range& range)
+    {
+        for (std::uintptr_t chunk = range.first >> table.shift; chunk <= (range.last - 1) >> table.shift; ++chunk)
+        {
+            size_type entry = bucket(chunk, table.bits);
+            while (table.entries[entry].count.load(std::memory_order_relaxed) != 0
+                   and table.entries[entry].chunk != chunk)
+            {
+                entry = (entry + 1) & (table.size - 1);
+            }
+            Entry& current = table.entries[entry];
+            const size_type count = current.count.load(std::memory_order_relaxed);
+            if (count == 0)
+            {
+                current.chunk = chunk;
+                ++mUsed;
+            }
+            current.ranges[count] = range;
+            current.count.store(count + 1, std::memory_order_release);
+        }
+    }
+
+    /// Build and publish a table holding every block, with chunks no
+    /// larger than the smallest block.
+    void rebuild()
+    {
+        std::uintptr_t smallest = mRanges.front().last - mRanges.front().first;
+        for (const Range& range : mRanges)
+        {
+            if (range.last - range.first < smallest) smallest = range.last - range.first;
+        }
+        size_type shift = 0;
+        while (smallest >> (shift + 1)) ++shift;
+        size_type needed = 0;
+        for (const Range& range : mRanges)
+        {
+            needed += chunks(range, shift);
+        }
+        size_type bits = 4;
+        while ((size_type(1) << bits) < needed * 4) ++bits;
+
+        mTables.push_back(mResource->create<Table>(bits, shift, mResource));
+        Table& table = *mTables.back();
+        mUsed = 0;
+        for (const Range& range : mRanges)
+        {
+            insert(table, range);
+        }
+        mTable.store(&table, std::memory_order_release);
+    }
+
+    std::atomic<Table*> mTable{nullptr};
+    /// Writer only, as is everything below.
+    PolyPoolVector<Range> mRanges;
+    /// The current table last, and those replaced since reclaim().
+    PolyPoolVector<PolyPoolOwner<Table> > mTables;
+    /// Entries of the current table holding a chunk.
+    size_type mUsed = 0;
+    PolyPoolMemoryResource* mResource;
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+
+#include "PolyPoolBitmap.h"
+#include "PolyPoolSpan.h"
+
+template <typename Child, typename Root>
+class PolyPoolSegment;
+
+/** The items of one block of a segment, as a contiguous array.
+
+    The span covers every slot handed out so far, live or free; free
+    slots hold dead objects that must not be touched. live() tells
+    them apart, and forEachRun() walks the runs of live items, which
+    are plain arrays for SIMD loops or memcpy.
+ */
+template <typename Child>
+class PolyPoolBlockSpan : public PolyPoolSpan<Child>
+{
+public:
+    using size_type=std::size_t;
+
+    PolyPoolBlockSpan(Child* data, size_type size, const PolyPoolBitmap& live)
+        : PolyPoolSpan<Child>(data, size)
+        , mLive(&live)
+    {
+    }
+
+    /// Which slots hold live items, over the block's whole capacity.
+    const PolyPoolBitmap& live() const
+    {
+        return *mLive;
+    }
+
+    /// Call f(first, count) on every run of consecutive live items.
+    template <typename F>
+    void forEachRun(F&& f) const
+    {
+        for (size_type first = mLive->findNext(0); first < this->size(); )
+        {
+            const size_type last = mLive->findNextUnset(first);
+            f(this->data() + first, last - first);
+            first = mLive->findNext(last);
+        }
+    }
+
+private:
+    const PolyPoolBitmap* mLive;
+};
+
+
+/** The blocks of a segment, as PolyPoolBlockSpan<Child>s in storage
+    order. See PolyPool::segments().
+
+    Adding items may add blocks, which the range picks up, but never
+    moves existing ones.
+ */
+template <typename Child, typename Root>
+class PolyPoolBlocks
+{
+public:
+    using size_type=std::size_t;
+    using value_type=PolyPoolBlockSpan<Child>;
+
+    class iterator
+    {
+    public:
+        using iterator_category=std::input_iterator_tag;
+        using value_type=PolyPoolBlockSpan<Child>;
+        using difference_type=std::ptrdiff_t;
+        using pointer=void;
+        using reference=PolyPoolBlockSpan<Child>;
+
+        iterator(PolyPoolSegment<Child, Root>* segment, size_type block)
+            : mSegment(segment)
+            , mBlock(block)
+        {
+        }
+
+        iterator& operator++()
+        {
+            ++mBlock;
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator previous = *this;
+            ++mBlock;
+            return previous;
+        }
+
+        bool operator==(const iterator& rhs) const
+        {
+            return mBlock == rhs.mBlock;
+        }
+        bool operator!=(const iterator& rhs) const
+        {
+            return not (*this == rhs);
+        }
+
+        PolyPoolBlockSpan<Child> operator*() const
+        {
+            return mSegment->blockSpan(mBlock);
+        }
+
+    private:
+        PolyPoolSegment<Child, Root>* mSegment;
+        size_type mBlock;
+    };
+
+    explicit PolyPoolBlocks(PolyPoolSegment<Child, Root>* segment)
+        : mSegment(segment)
+    {
+    }
+
+    PolyPoolBlockSpan<Child> operator[](size_type block) const
+    {
+        return mSegment->blockSpan(block);
+    }
+    size_type size() const
+    {
+        return mSegment->blocks();
+    }
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    iterator begin() const
+    {
+        return iterator(mSegment, 0);
+    }
+    iterator end() const
+    {
+        return iterator(mSegment, size());
+    }
+
+private:
+    PolyPoolSegment<Child, Root>* mSegment;
+};
@@ -0,0 +1,792 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "PolyPoolBlocks.h"
+#include "PolyPoolIterator.h"
+#include "PolyPoolSegment.h"
+#include "PolyPoolSnapshot.h"
+
+/// Position of type T in a list of types, resolved at compile time.
+template <typename T, typename... Types>
+struct PolyPoolTypeIndex;
+
+template <typename T, typename... Rest>
+struct PolyPoolTypeIndex<T, T, Rest...>
+    : std::integral_constant<std::size_t, 0>
+{
+};
+
+template <typename T, typename First, typename... Rest>
+struct PolyPoolTypeIndex<T, First, Rest...>
+    : std::integral_constant<std::size_t, 1 + PolyPoolTypeIndex<T, Rest...>::value>
+{
+};
+
+template <typename T>
+struct PolyPoolTypeIndex<T>
+{
+    static_assert(sizeof(T) == 0, "Type is not stored by this PolyPool.");
+};
+
+/// Whether type T is in a list of types.
+template <typename T, typename... Types>
+struct PolyPoolContains : std::false_type
+{
+};
+
+template <typename T, typename... Rest>
+struct PolyPoolContains<T, T, Rest...> : std::true_type
+{
+};
+
+template <typename T, typename First, typename... Rest>
+struct PolyPoolContains<T, First, Rest...> : PolyPoolContains<T, Rest...>
+{
+};
+
+/// Number of types in a list that are type T or derive from it.
+template <typename T, typename... Types>
+struct PolyPoolCountDerived : std::integral_constant<std::size_t, 0>
+{
+};
+
+template <typename T, typename First, typename... Rest>
+struct PolyPoolCountDerived<T, First, Rest...>
+    : std::integral_constant<std::size_t, std::is_base_of<T, First>::value
+                                              + PolyPoolCountDerived<T, Rest...>::value>
+{
+};
+
+/** Closed-world polymorphic object pool.
+
+    PolyPool<Root, Types...> stores exactly the listed types, which
+    must be children of the root type or the root type itself. Each
+    type gets its own segment, held in a std::tuple, and every type
+    lookup is resolved at compile time. No RTTI is used, so this
+    header builds with -fno-rtti.
+
+    Whole-pool operations such as for_each() are unrolled over the
+    type list, calling back with each item's static type. This lets
+    the compiler inline and devirtualize calls on items.
+
+    The open-world PolyPool<Root>, which accepts any child type at
+    runtime, is declared in PolyPool.h.
+ */
+template <typename Root, typename... Types>
+class PolyPool
+{
+    template <bool...>
+    struct bools
+    {
+    };
+    template <bool... Conditions>
+    using all=std::is_same<bools<Conditions...>, bools<(Conditions or true)...> >;
+
+    static_assert(sizeof...(Types) > 0,
+                  "Include PolyPool.h for the open-world PolyPool<Root>.");
+    static_assert(all<std::is_base_of<Root, Types>::value...>::value,
+                  "All types stored must be children of the root type.");
+
+    using segment_list=std::array<PolyPoolSegmentBase<Root>*, sizeof...(Types)>;
+
+public:
+    using size_type=std::size_t;
+    using iterator=PolyPoolIterator<Root, segment_list>;
+    template <typename Child>
+    using Handle=PolyPoolHandle<Child>;
+
+    PolyPool()
+        : PolyPool(20)
+    {
+    }
+
+    explicit PolyPool(size_type defaultBlockSize,
+                      PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : mResource(resource)
+        , mSegments(PolyPoolSegment<Types, Root>(defaultBlockSize, resource)...)
+    {
+    }
+    /** Same, for literal block sizes: without it, PolyPool(0) would be
+        ambiguous with the resource constructor. Negative sizes are
+        taken as zero.
+     */
+    explicit PolyPool(int defaultBlockSize,
+                      PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : PolyPool(size_type(defaultBlockSize > 0 ? defaultBlockSize : 0), resource)
+    {
+    }
+
+    /** Pool drawing all its memory from a resource, which must
+        outlive the pool.
+     */
+    explicit PolyPool(PolyPoolMemoryResource* resource)
+        : PolyPool(20, resource)
+    {
+    }
+
+    /// Index of a type in the pool's type list.
+    template <typename Child>
+    static constexpr size_type typeIndex()
+    {
+        return PolyPoolTypeIndex<Child, Types...>::value;
+    }
+
+    template <typename Child>
+    typename std::decay<Child>::type* insert(Child&& child)
+    {
+        using Type=typename std::decay<Child>::type;
+        return segment<Type>().emplace(std::forward<Child>(child));
+    }
+
+    template <typename Child, typename... Args>
+    Child* emplace(Args&&... args)
+    {
+        return segment<Child>().emplace(std::forward<Args>(args)...);
+    }
+
+    /** Construct count objects from the same arguments.
+
+        Reuses free objects first, then builds the rest block by block
+        in one pass. Much cheaper than count calls to emplace().
+     */
+    template <typename Child, typename... Args>
+    PolyPoolVector<Child*> emplace_n(size_type count, const Args&... args)
+    {
+        return segment<Child>().emplace_n(count, args...);
+    }
+    /** Construct an object from each element of [first, last).
+        See emplace_n() for notes.
+     */
+    template <typename InputIt,
+              typename Child=typename std::iterator_traits<InputIt>::value_type>
+    PolyPoolVector<Child*> insert_range(InputIt first, InputIt last)
+    {
+        return segment<Child>().insert_range(first, last);
+    }
+
+    /** Add object to free object list.
+
+        The object destructor is not called. To both destruct and free
+        an object, see destroy().
+     */
+    template <typename Child>
+    void free(Child* item)
+    {
+        dispatch(item, exact<Child>(), Free());
+    }
+    /** Call object destructor and add it to free object list.
+        See PolyPool<Root>::destroy() for notes.
+
+        The object may be given through a pointer to any of its bases.
+        If the pointer's type is stored by the pool and none of the
+        others derive from it, its segment is known at compile time.
+        Otherwise the segments of the types deriving from it are
+        searched for the one holding the object, and
+        std::invalid_argument is thrown if there is none.
+     */
+    template <typename Child>
+    void destroy(Child* item)
+    {
+        dispatch(item, exact<Child>(), Destroy());
+    }
+    /** Destroy a range of objects given by pointer.
+        See destroy() for notes.
+
+        Objects given through a pointer to their exact type are
+        destroyed in address order at once. Others are destroyed one
+        by one.
+     */
+    template <typename ForwardIt>
+    void destroy(ForwardIt first, ForwardIt last)
+    {
+        using Child=typename std::remove_pointer<
+            typename std::iterator_traits<ForwardIt>::value_type>::type;
+        destroyRange<Child>(first, last, exact<Child>());
+    }
+    /** Destroy every object for which pred(object) is true.
+
+        pred is called with each object's static type, so like
+        for_each() it must accept every type in the pool.
+
+        Returns the number of objects destroyed.
+     */
+    template <typename Predicate>
+    size_type destroy_if(Predicate&& pred)
+    {
+        size_type destroyed = 0;
+        (void)expand{0, (destroyed += segment<Types>().destroy_if(pred), 0)...};
+        return destroyed;
+    }
+    template <typename Child, typename Predicate>
+    size_type destroy_if(Predicate&& pred)
+    {
+        return segment<Child>().destroy_if(std::forward<Predicate>(pred));
+    }
+    /** Destroy object and set its pointer to nullptr.
+        See destroy() for notes.
+     */
+    template <typename Child>
+    void nullify(Child*& item)
+    {
+        destroy(item);
+        item = nullptr;
+    }
+
+    /** Keep an object constructed for acquire<Child>() instead of
+        destroying it. See PolyPool<Root>::release() for notes.
+
+        Like destroy(), objects may be given through a pointer to any
+        of their bases.
+     */
+    template <typename Child>
+    void release(Child* item)
+    {
+        dispatch(item, exact<Child>(), Release());
+    }
+    /** The most recently released object of a type, or a new one
+        constructed from args if none is left.
+     */
+    template <typename Child, typename... Args>
+    Child* acquire(Args&&... args)
+    {
+        return segment<Child>().acquire(std::forward<Args>(args)...);
+    }
+    /// Construct count released objects from the same arguments.
+    template <typename Child, typename... Args>
+    void prewarm(size_type count, const Args&... args)
+    {
+        segment<Child>().prewarm(count, args...);
+    }
+
+    /** Get a handle to an item.
+        See PolyPool<Root>::handle() for notes. Items of a type deriving
+        from Child are held by another segment, so they throw too.
+     */
+    template <typename Child>
+    Handle<Child> handle(Child* item)
+    {
+        return segment<Child>().handle(item);
+    }
+    /// The item a handle refers to, or nullptr if it is gone.
+    template <typename Child>
+    Child* resolve(Handle<Child> handle)
+    {
+        return segment<Child>().resolve(handle);
+    }
+
+    bool empty()
+    {
+        return active() == 0;
+    }
+    template <typename Child>
+    bool empty()
+    {
+        return segment<Child>().empty();
+    }
+
+    /// Number of active items.
+    size_type active()
+    {
+        size_type size = 0;
+        (void)expand{0, (size += segment<Types>().active(), 0)...};
+        return size;
+    }
+    template <typename Child>
+    size_type active()
+    {
+        return segment<Child>().active();
+    }
+
+    /// Number of free items.
+    size_type holes()
+    {
+        size_type size = 0;
+        (void)expand{0, (size += segment<Types>().holes(), 0)...};
+        return size;
+    }
+    template <typename Child>
+    size_type holes()
+    {
+        return segment<Child>().holes();
+    }
+
+    /// Number of released objects of a type, see release().
+    template <typename Child>
+    size_type warm()
+    {
+        return segment<Child>().warm();
+    }
+
+    /// Number of active + free items.
+    size_type size()
+    {
+        size_type size = 0;
+        (void)expand{0, (size += segment<Types>().size(), 0)...};
+        return size;
+    }
+    template <typename Child>
+    size_type size()
+    {
+        return segment<Child>().size();
+    }
+
+    /// Total number of items, active + free + spare.
+    size_type capacity()
+    {
+        size_type size = 0;
+        (void)expand{0, (size += segment<Types>().capacity(), 0)...};
+        return size;
+    }
+    template <typename Child>
+    size_type capacity()
+    {
+        return segment<Child>().capacity();
+    }
+
+    /// Number of blocks.
+    size_type blocks()
+    {
+        size_type size = 0;
+        (void)expand{0, (size += segment<Types>().blocks(), 0)...};
+        return size;
+    }
+    template <typename Child>
+    size_type blocks()
+    {
+        return segment<Child>().blocks();
+    }
+
+    /// Snapshot of the counters of all types, see PolyPoolStats.
+    PolyPoolStats stats()
+    {
+        PolyPoolStats stats;
+        (void)expand{0, (stats += segment<Types>().stats(), 0)...};
+        return stats;
+    }
+    template <typename Child>
+    PolyPoolStats stats()
+    {
+        return segment<Child>().stats();
+    }
+
+    /// Set the block size of newly created blocks for a type.
+    template <typename Child>
+    void setDefaultBlockSize(size_type size)
+    {
+        segment<Child>().setBlockSize(size);
+    }
+    /// Set the block size of newly created blocks for all types.
+    void setDefaultBlockSize(size_type size)
+    {
+        (void)expand{0, (segment<Types>().setBlockSize(size), 0)...};
+    }
+
+    /// Choose the capacity of a type's new blocks by a growth policy.
+    template <typename Child>
+    void setGrowth(PolyPoolGrowth growth)
+    {
+        segment<Child>().setGrowth(std::move(growth));
+    }
+    /// Set the growth policy of all types.
+    void setGrowth(const PolyPoolGrowth& growth)
+    {
+        (void)expand{0, (segment<Types>().setGrowth(growth), 0)...};
+    }
+
+    /// Choose which free slots new items of a type go to.
+    template <typename Child>
+    void setReuse(PolyPoolReuse reuse)
+    {
+        segment<Child>().setReuse(reuse);
+    }
+    /// Choose which free slots new items of all types go to.
+    void setReuse(PolyPoolReuse reuse)
+    {
+        (void)expand{0, (segment<Types>().setReuse(reuse), 0)...};
+    }
+
+    /** Draw the blocks of a type from a resource of its own, see
+        PolyPool<Root>::setBlockResource().
+     */
+    template <typename Child>
+    void setBlockResource(PolyPoolMemoryResource* resource)
+    {
+        segment<Child>().setBlockResource(resource);
+    }
+
+    /** Destruct and free all objects in container without
+        deallocating memory.
+     */
+    void freeAll()
+    {
+        (void)expand{0, (segment<Types>().freeAll(), 0)...};
+    }
+    template <typename Child>
+    void freeAll()
+    {
+        segment<Child>().freeAll();
+    }
+
+    /// Destruct all objects in container and deallocate their blocks.
+    void clear()
+    {
+        (void)expand{0, (segment<Types>().clear(), 0)...};
+    }
+    template <typename Child>
+    void clear()
+    {
+        segment<Child>().clear();
+    }
+
+    /** Call f on every active object, type by type.
+
+        f is called with each object's static type, so it must accept
+        every type in the pool (for instance by taking Root&, being
+        overloaded or having a templated call operator).
+     */
+    template <typename F>
+    void for_each(F&& f)
+    {
+        (void)expand{0, (segment<Types>().for_each(f), 0)...};
+    }
+    /** Call f on every active object, type by type.
+
+        f is called with the static type of objects of the listed
+        types, and with Root& for all other objects.
+     */
+    template <typename Child, typename... Listed, typename F>
+    void for_each(F&& f)
+    {
+        (void)expand{0, (forEachIn<Types>(f, PolyPoolContains<Types, Child, Listed...>()), 0)...};
+    }
+
+    /** Call f on every active object from several threads at once.
+        See PolyPool<Root>::parallel_for_each() for notes.
+
+        Like for_each(), f is called with each object's static type.
+     */
+    template <typename F>
+    void parallel_for_each(F&& f, PolyPoolExecutor& executor = PolyPoolExecutor::shared())
+    {
+        PolyPoolExecutor::task_list tasks(mResource);
+        (void)expand{0, (segment<Types>().parallelTasks(f, tasks), 0)...};
+        executor.run(tasks);
+    }
+    /** Call f on every active object from several threads at once.
+        Like for_each<Child, ...>(), objects of other types than those
+        listed are passed as Root&.
+     */
+    template <typename Child, typename... Listed, typename F>
+    void parallel_for_each(F&& f, PolyPoolExecutor& executor = PolyPoolExecutor::shared())
+    {
+        PolyPoolExecutor::task_list tasks(mResource);
+        (void)expand{0, (parallelTasksIn<Types>(f, tasks, PolyPoolContains<Types, Child, Listed...>()), 0)...};
+        executor.run(tasks);
+    }
+
+    /** Move active objects until they are contiguous in memory.
+        See PolyPool<Root>::defragment() for notes.
+
+        relocate(old, new) is called with each object's static type,
+        so like for_each() it must accept every type in the pool.
+     */
+    template <typename F>
+    void defragment(F&& relocate)
+    {
+        (void)expand{0, (segment<Types>().defragment(relocate), 0)...};
+    }
+    void defragment()
+    {
+        (void)expand{0, (segment<Types>().defragment(), 0)...};
+    }
+    template <typename Child, typename F>
+    void defragment(F&& relocate)
+    {
+        segment<Child>().defragment(std::forward<F>(relocate));
+    }
+    template <typename Child>
+    void defragment()
+    {
+        segment<Child>().defragment();
+    }
+
+    /** Deallocate blocks with only free objects.
+        See PolyPool<Root>::shrink_to_fit() for notes.
+     */
+    void shrink_to_fit()
+    {
+        (void)expand{0, (segment<Types>().shrink_to_fit(), 0)...};
+    }
+    template <typename Child>
+    void shrink_to_fit()
+    {
+        segment<Child>().shrink_to_fit();
+    }
+
+    /// Calls defragment() followed by shrink_to_fit().
+    void compactify()
+    {
+        defragment();
+        shrink_to_fit();
+    }
+    template <typename Child>
+    void compactify()
+    {
+        defragment<Child>();
+        shrink_to_fit<Child>();
+    }
+
+    /** Write all objects to a snapshot file, for load() to restore.
+        Types are identified by their position in the type list. See
+        PolyPool<Root>::save() for notes.
+     */
+    void save(const std::string& path)
+    {
+        PolyPoolSnapshotWriter out(path, sizeof...(Types));
+        size_type index = 0;
+        (void)expand{0, (out.writeString(std::to_string(index++)),
+                         segment<Types>().saveItems(out), 0)...};
+        out.close();
+    }
+    /** Restore objects written by save(), into types holding no
+        blocks. See PolyPool<Root>::load() for notes.
+     */
+    void load(const std::string& path)
+    {
+        PolyPoolSegmentBase<Root>* segments[] = {&segment<Types>()...};
+        auto in = std::make_shared<PolyPoolSnapshotFile>(path);
+        const size_type count = in->readHeader();
+        for (size_type loaded = 0; loaded < count; loaded++)
+        {
+            const std::string key = in->readString();
+            size_type index = 0;
+            while (index < sizeof...(Types) and key != std::to_string(index))
+            {
+                ++index;
+            }
+            if (index == sizeof...(Types))
+            {
+                throw std::runtime_error("Snapshot holds unknown type " + key);
+            }
+            segments[index]->loadItems(in);
+        }
+    }
+
+    /** Iterate over all active objects as Root, type by type in the
+        order of the type list. See for_each() to visit objects with
+        their static type instead.
+     */
+    iterator begin()
+    {
+        iterator iter(&segmentList(), 0);
+        iter.seekActive();
+        return iter;
+    }
+    iterator end()
+    {
+        return iterator(&segmentList(), sizeof...(Types));
+    }
+    std::reverse_iterator<iterator> rbegin()
+    {
+        return std::reverse_iterator<iterator>(end());
+    }
+    std::reverse_iterator<iterator> rend()
+    {
+        return std::reverse_iterator<iterator>(begin());
+    }
+
+    template <typename Child>
+    PolyPoolLocalIterator<Child, Root> begin()
+    {
+        return segment<Child>().begin();
+    }
+    template <typename Child>
+    PolyPoolLocalIterator<Child, Root> end()
+    {
+        return segment<Child>().end();
+    }
+    template <typename Child>
+    std::reverse_iterator<PolyPoolLocalIterator<Child, Root> > rbegin()
+    {
+        return std::reverse_iterator<PolyPoolLocalIterator<Child, Root> >(end<Child>());
+    }
+    template <typename Child>
+    std::reverse_iterator<PolyPoolLocalIterator<Child, Root> > rend()
+    {
+        return std::reverse_iterator<PolyPoolLocalIterator<Child, Root> >(begin<Child>());
+    }
+
+    /** The blocks holding items of a type, each as a contiguous array
+        of Child plus the bitmap of its live slots, for loops that
+        want raw pointers rather than iterators:
+
+            for (auto block : pool.segments<Particle>())
+            {
+                block.forEachRun([](Particle* first, std::size_t count)
+                {
+                    for (std::size_t i = 0; i < count; i++) first[i].x += first[i].vx;
+                });
+            }
+
+        Requires a layout without padding between items.
+     */
+    template <typename Child>
+    PolyPoolBlocks<Child, Root> segments()
+    {
+        return PolyPoolBlocks<Child, Root>(&segment<Child>());
+    }
+
+    // For range loops of local iterators.
+    template <typename Child>
+    struct Local
+    {
+        PolyPool<Root, Types...>* pool;
+        Local(PolyPool<Root, Types...>* poolIn) : pool(poolIn) {}
+
+        PolyPoolLocalIterator<Child, Root> begin()
+        {
+            return pool->template begin<Child>();
+        }
+        PolyPoolLocalIterator<Child, Root> end()
+        {
+            return pool->template end<Child>();
+        }
+    };
+
+    template <typename Child>
+    Local<Child> local()
+    {
+        return Local<Child>(this);
+    }
+
+protected:
+    /// Source of the segments and of temporary containers.
+    PolyPoolMemoryResource* mResource;
+    /// One segment per type, in type list order.
+    std::tuple<PolyPoolSegment<Types, Root>...> mSegments;
+    /// The segments seen through their base, for iterators.
+    segment_list mSegmentList;
+
+    using expand=int[];
+
+    template <typename Child>
+    PolyPoolSegment<Child, Root>& segment()
+    {
+        return std::get<PolyPoolTypeIndex<Child, Types...>::value>(mSegments);
+    }
+
+    /// The segment list, pointing into this pool even after a move.
+    const segment_list& segmentList()
+    {
+        mSegmentList = segment_list{{&segment<Types>()...}};
+        return mSegmentList;
+    }
+
+    /// Whether pointers to Child always point to items of type Child.
+    template <typename Child>
+    using exact=std::integral_constant<bool, PolyPoolContains<Child, Types...>::value
+                                                 and PolyPoolCountDerived<Child, Types...>::value == 1>;
+
+    /// Operations on an item of the segment's type, for dispatch().
+    struct Free
+    {
+        template <typename Type>
+        void operator()(PolyPoolSegment<Type, Root>& segment, Type* item) const
+        {
+            segment.free(item);
+        }
+    };
+    struct Destroy
+    {
+        template <typename Type>
+        void operator()(PolyPoolSegment<Type, Root>& segment, Type* item) const
+        {
+            segment.destroy(item);
+        }
+    };
+    struct Release
+    {
+        template <typename Type>
+        void operator()(PolyPoolSegment<Type, Root>& segment, Type* item) const
+        {
+            segment.release(item);
+        }
+    };
+
+    /** Call op(segment, item) with the segment holding item, and item
+        cast to that segment's type.
+     */
+    template <typename Child, typename Op>
+    void dispatch(Child* item, std::true_type, Op op)
+    {
+        op(segment<Child>(), item);
+    }
+    template <typename Child, typename Op>
+    void dispatch(Child* item, std::false_type, Op op)
+    {
+        static_assert(PolyPoolCountDerived<Child, Types...>::value > 0,
+                      "Type is neither stored by this PolyPool nor a base of a type stored.");
+        bool found = false;
+        (void)expand{0, (dispatchTo<Types>(item, found, op, std::is_base_of<Child, Types>()), 0)...};
+        if (not found) throw std::invalid_argument("Object is not stored by this PolyPool.");
+    }
+    template <typename Type, typename Child, typename Op>
+    void dispatchTo(Child* item, bool& found, Op& op, std::true_type)
+    {
+        if (found or not segment<Type>().contains(item)) return;
+        found = true;
+        op(segment<Type>(), static_cast<Type*>(item));
+    }
+    template <typename Type, typename Child, typename Op>
+    void dispatchTo(Child*, bool&, Op&, std::false_type)
+    {
+    }
+
+    template <typename Child, typename ForwardIt>
+    void destroyRange(ForwardIt first, ForwardIt last, std::true_type)
+    {
+        segment<Child>().destroy(first, last);
+    }
+    template <typename Child, typename ForwardIt>
+    void destroyRange(ForwardIt first, ForwardIt last, std::false_type)
+    {
+        for (; first != last; ++first)
+        {
+            destroy(*first);
+        }
+    }
+
+    template <typename Child, typename F>
+    void forEachIn(F& f, std::true_type)
+    {
+        segment<Child>().for_each(f);
+    }
+    template <typename Child, typename F>
+    void forEachIn(F& f, std::false_type)
+    {
+        segment<Child>().forEachRoot(f);
+    }
+
+    template <typename Child, typename F>
+    void parallelTasksIn(F& f, PolyPoolExecutor::task_list& tasks, std::true_type)
+    {
+        segment<Child>().parallelTasks(f, tasks);
+    }
+    template <typename Child, typename F>
+    void parallelTasksIn(F& f, PolyPoolExecutor::task_list& tasks, std::false_type)
+    {
+        segment<Child>().parallelRootTasks(f, tasks);
+    }
+
+private:
+};
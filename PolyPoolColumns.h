@@ -0,0 +1,301 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "PolyPoolBitmap.h"
+#include "PolyPoolMemory.h"
+#include "PolyPoolSpan.h"
+
+/** The fields of a plain-data type, for storage in PolyPoolColumns.
+
+    Specialize with a members() function returning a tuple of pointers
+    to the fields to store:
+
+        template <>
+        struct PolyPoolFields<Particle>
+        {
+            static std::tuple<float Particle::*, float Particle::*> members()
+            {
+                return std::make_tuple(&Particle::x, &Particle::y);
+            }
+        };
+
+    Fields left out are not stored, and read back default initialized.
+ */
+template <typename Child>
+struct PolyPoolFields;
+
+
+/** Structure-of-arrays storage for a plain-data type.
+
+    Like a PolyPool segment, items live in fixed-capacity blocks that
+    never move, with a bitmap of live slots and free slots reused
+    first. But within a block, each field described by
+    PolyPoolFields<Child> is stored as a column of its own, starting
+    on a cache line. Kernels touching one or two fields thus stream
+    through just those columns, which column() exposes per block for
+    vectorized loops.
+
+    Items are addressed by row, which stays valid until the item is
+    destroyed. The object API works on copies: get() gathers a row
+    into a Child, and set() scatters one back.
+
+    Columns hold items only by value, so they cannot take part in the
+    virtual dispatch of a PolyPool. Keep them alongside one, with
+    rows stored in the objects that own the data.
+ */
+template <typename Child>
+class PolyPoolColumns
+{
+    using members=decltype(PolyPoolFields<Child>::members());
+
+    template <typename Member>
+    struct MemberType;
+    template <typename T>
+    struct MemberType<T Child::*>
+    {
+        using type=T;
+    };
+
+    static_assert(std::is_trivially_copyable<Child>::value
+                  and std::is_default_constructible<Child>::value,
+                  "Column storage requires a plain-data type.");
+    static_assert(std::tuple_size<members>::value > 0,
+                  "PolyPoolFields must list at least one field.");
+
+public:
+    using size_type=std::size_t;
+    using row_type=std::size_t;
+    template <std::size_t Column>
+    using column_type=typename MemberType<typename std::tuple_element<Column, members>::type>::type;
+
+    static const size_type columns = std::tuple_size<members>::value;
+    /// Alignment of the start of every column.
+    static const size_type columnAlignment = 64;
+
+    /// A block size of zero is taken as one, as for pool segments.
+    explicit PolyPoolColumns(size_type blockSize = 256,
+                             PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : mResource(resource)
+        , mBlocks(resource)
+        , mFreeRows(resource)
+        , mBlockSize(blockSize > 0 ? blockSize : 1)
+    {
+        layout(std::integral_constant<size_type, 0>());
+    }
+
+    PolyPoolColumns(const PolyPoolColumns&) = delete;
+    PolyPoolColumns& operator=(const PolyPoolColumns&) = delete;
+
+    ~PolyPoolColumns()
+    {
+        for (auto& block : mBlocks)
+        {
+            mResource->deallocate(block.data, mBlockBytes, columnAlignment);
+        }
+    }
+
+    /// Store a copy of child in a free or fresh row.
+    row_type insert(const Child& child)
+    {
+        const row_type row = allocateRow();
+        scatter(row, child, std::integral_constant<size_type, 0>());
+        mBlocks[row / mBlockSize].live.set(row % mBlockSize);
+        ++mActive;
+        return row;
+    }
+    template <typename... Args>
+    row_type emplace(Args&&... args)
+    {
+        return insert(Child(std::forward<Args>(args)...));
+    }
+
+    /** Free a row. Throws std::invalid_argument if the row holds no
+        live item, such as one already destroyed.
+     */
+    void destroy(row_type row)
+    {
+        if (not contains(row)) throw std::invalid_argument("Row holds no item of this PolyPoolColumns.");
+        mBlocks[row / mBlockSize].live.reset(row % mBlockSize);
+        mFreeRows.push_back(row);
+        --mActive;
+    }
+
+    /// Whether a row holds a live item.
+    bool contains(row_type row) const
+    {
+        return row / mBlockSize < mBlocks.size()
+            and mBlocks[row / mBlockSize].live.test(row % mBlockSize);
+    }
+
+    /// Copy of the item in a row.
+    Child get(row_type row) const
+    {
+        Child child = Child();
+        gather(row, child, std::integral_constant<size_type, 0>());
+        return child;
+    }
+    /// Overwrite the item in a row.
+    void set(row_type row, const Child& child)
+    {
+        scatter(row, child, std::integral_constant<size_type, 0>());
+    }
+
+    /// A single field of the item in a row.
+    template <std::size_t Column>
+    column_type<Column>& field(row_type row)
+    {
+        return column<Column>(row / mBlockSize)[row % mBlockSize];
+    }
+
+    /** Call f on a copy of every live item, in storage order, and
+        store it back afterwards.
+     */
+    template <typename F>
+    void for_each(F&& f)
+    {
+        for (size_type block = 0; block < mBlocks.size(); block++)
+        {
+            const PolyPoolBitmap& live = mBlocks[block].live;
+            for (size_type slot = live.findNext(0); slot < live.size();
+                 slot = live.findNext(slot + 1))
+            {
+                const row_type row = block * mBlockSize + slot;
+                Child child = get(row);
+                f(child);
+                set(row, child);
+            }
+        }
+    }
+
+    /** One field of every slot handed out in a block, live or free.
+        Free slots keep the values they last held; see slots().
+     */
+    template <std::size_t Column>
+    PolyPoolSpan<column_type<Column> > column(size_type block)
+    {
+        return PolyPoolSpan<column_type<Column> >(columnData<Column>(block), mBlocks[block].size);
+    }
+    template <std::size_t Column>
+    PolyPoolSpan<const column_type<Column> > column(size_type block) const
+    {
+        return PolyPoolSpan<const column_type<Column> >(columnData<Column>(block), mBlocks[block].size);
+    }
+    /// Which slots of a block hold live items.
+    const PolyPoolBitmap& slots(size_type block) const
+    {
+        return mBlocks[block].live;
+    }
+
+    bool empty() const
+    {
+        return mActive == 0;
+    }
+    /// Number of active items.
+    size_type active() const
+    {
+        return mActive;
+    }
+    /// Total number of items, active + free + spare.
+    size_type capacity() const
+    {
+        return mBlocks.size() * mBlockSize;
+    }
+    size_type blocks() const
+    {
+        return mBlocks.size();
+    }
+    size_type blockSize() const
+    {
+        return mBlockSize;
+    }
+
+protected:
+    struct Block
+    {
+        unsigned char* data;
+        /// Slots handed out so far, active or free.
+        size_type size;
+        PolyPoolBitmap live;
+    };
+
+    PolyPoolMemoryResource* mResource;
+    PolyPoolVector<Block> mBlocks;
+    PolyPoolVector<row_type> mFreeRows;
+    const size_type mBlockSize;
+    /// Offset of each column within a block.
+    size_type mOffsets[columns];
+    size_type mBlockBytes = 0;
+    size_type mActive = 0;
+
+    row_type allocateRow()
+    {
+        if (not mFreeRows.empty())
+        {
+            const row_type row = mFreeRows.back();
+            mFreeRows.pop_back();
+            return row;
+        }
+        if (mBlocks.empty() or mBlocks.back().size == mBlockSize)
+        {
+            mBlocks.push_back(Block{
+                static_cast<unsigned char*>(mResource->allocate(mBlockBytes, columnAlignment)),
+                0,
+                PolyPoolBitmap(mBlockSize, mResource)});
+        }
+        return (mBlocks.size() - 1) * mBlockSize + mBlocks.back().size++;
+    }
+
+    template <std::size_t Column>
+    column_type<Column>* columnData(size_type block) const
+    {
+        return reinterpret_cast<column_type<Column>*>(mBlocks[block].data + mOffsets[Column]);
+    }
+
+    void layout(std::integral_constant<size_type, columns>)
+    {
+    }
+    template <size_type Column>
+    void layout(std::integral_constant<size_type, Column>)
+    {
+        static_assert(alignof(column_type<Column>) <= columnAlignment,
+                      "Fields must not be aligned beyond a cache line.");
+        mOffsets[Column] = mBlockBytes;
+        const size_type bytes = mBlockSize * sizeof(column_type<Column>);
+        mBlockBytes += (bytes + columnAlignment - 1) / columnAlignment * columnAlignment;
+        layout(std::integral_constant<size_type, Column + 1>());
+    }
+
+    void scatter(row_type, const Child&, std::integral_constant<size_type, columns>)
+    {
+    }
+    template <size_type Column>
+    void scatter(row_type row, const Child& child, std::integral_constant<size_type, Column>)
+    {
+        const auto member = std::get<Column>(PolyPoolFields<Child>::members());
+        columnData<Column>(row / mBlockSize)[row % mBlockSize] = child.*member;
+        scatter(row, child, std::integral_constant<size_type, Column + 1>());
+    }
+
+    void gather(row_type, Child&, std::integral_constant<size_type, columns>) const
+    {
+    }
+    template <size_type Column>
+    void gather(row_type row, Child& child, std::integral_constant<size_type, Column>) const
+    {
+        const auto member = std::get<Column>(PolyPoolFields<Child>::members());
+        child.*member = columnData<Column>(row / mBlockSize)[row % mBlockSize];
+        gather(row, child, std::integral_constant<size_type, Column + 1>());
+    }
+
+private:
+};
+
+template <typename Child>
+const typename PolyPoolColumns<Child>::size_type PolyPoolColumns<Child>::columns;
+template <typename Child>
+const typename PolyPoolColumns<Child>::size_type PolyPoolColumns<Child>::columnAlignment;
@@ -0,0 +1,426 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "PolyPoolBlockMap.h"
+#include "PolyPoolIterator.h"
+#include "PolyPoolSegment.h"
+#include "PolyPoolType.h"
+
+/** Open-world polymorphic object pool for use from several threads.
+
+    Threads add and destroy objects through a Cache, one per thread,
+    taken from the pool with cache(). Each cache owns a private
+    segment per type, so its free slots (the magazine) and the block
+    it is filling (the bump region) are only ever touched by its own
+    thread, without locking.
+
+    The pool itself is only locked when a cache is taken or returned,
+    and when a cache creates a segment or a block. An object destroyed
+    by a thread other than the one whose cache created it is found in
+    a lock-free directory of blocks. Such remote destroys run the
+    destructor right away and push the slot on a lock-free queue of
+    the owning segment. The owning cache takes those slots back once
+    it runs out of free slots.
+
+    Whole-pool operations, such as iterating or counting objects,
+    first collect all pending remote destroys. They must only be used
+    while no cache is adding or destroying objects.
+
+    Caches must be destroyed before their pool. A cache returned to
+    the pool keeps its objects, and is handed out again by a later
+    call to cache().
+ */
+template <typename Root>
+class PolyPoolConcurrent
+{
+    /// Lock-free stack of slots destroyed by threads other than the owner.
+    struct RemoteFrees
+    {
+        explicit RemoteFrees(PolyPoolSegmentBase<Root>* segment)
+            : segment(segment)
+        {
+        }
+
+        /// The segment the slots belong to.
+        PolyPoolSegmentBase<Root>* segment;
+        std::atomic<void*> head{nullptr};
+
+        void push(void* slot)
+        {
+            void* next = head.load(std::memory_order_relaxed);
+            do
+            {
+                std::memcpy(slot, &next, sizeof(next));
+            } while (not head.compare_exchange_weak(next, slot,
+                                                    std::memory_order_release,
+                                                    std::memory_order_relaxed));
+        }
+        /// Take all slots, as a list linked through the slots.
+        void* takeAll()
+        {
+            if (not head.load(std::memory_order_relaxed)) return nullptr;
+            return head.exchange(nullptr, std::memory_order_acquire);
+        }
+    };
+
+    /// A segment as seen by its owning cache.
+    struct Local
+    {
+        PolyPoolSegmentBase<Root>* segment;
+        RemoteFrees* remote;
+        /// Blocks already published in the block directory.
+        std::size_t blocks;
+    };
+
+    /// The segments owned by one cache.
+    struct Shard
+    {
+        explicit Shard(PolyPoolMemoryResource* resource)
+            : segments(0, std::hash<std::type_index>(), std::equal_to<std::type_index>(), resource)
+        {
+        }
+
+        std::unordered_map<std::type_index, Local,
+                           std::hash<std::type_index>, std::equal_to<std::type_index>,
+                           PolyPoolAllocator<std::pair<const std::type_index, Local> > >
+            segments;
+    };
+
+public:
+    using size_type=std::size_t;
+    using segment_list=PolyPoolVector<PolyPoolOwner<PolyPoolSegmentBase<Root> > >;
+
+    /** Per-thread front end of a PolyPoolConcurrent.
+        Must only be used by one thread at a time.
+     */
+    class Cache
+    {
+        friend class PolyPoolConcurrent<Root>;
+
+    public:
+        Cache(Cache&& other)
+            : mPool(other.mPool)
+            , mShard(other.mShard)
+        {
+            other.mShard = nullptr;
+        }
+        Cache(const Cache&) = delete;
+        Cache& operator=(const Cache&) = delete;
+
+        ~Cache()
+        {
+            if (mShard) mPool->release(mShard);
+        }
+
+        template <typename Child>
+        typename std::decay<Child>::type* insert(Child&& child)
+        {
+            using Type=typename std::decay<Child>::type;
+            return emplace<Type>(std::forward<Child>(child));
+        }
+
+        template <typename Child, typename... Args>
+        Child* emplace(Args&&... args)
+        {
+            Local& local = mPool->template local<Child>(*mShard);
+            auto& segment = static_cast<PolyPoolSegment<Child, Root>&>(*local.segment);
+            if (segment.holes() == 0)
+            {
+                mPool->collect(local);
+            }
+            Child* item = segment.emplace(std::forward<Args>(args)...);
+            if (segment.blocks() != local.blocks)
+            {
+                mPool->publish(local);
+            }
+            return item;
+        }
+
+        /** Call object destructor and free its slot.
+            Objects created through other caches are handed back to
+            their owner, see PolyPoolConcurrent. Objects are found as
+            by PolyPool::destroy().
+         */
+        template <typename Child>
+        void destroy(Child* item)
+        {
+            auto local = mShard->segments.find(PolyPoolFiledType<Child>::of(item));
+            if (local != mShard->segments.end()
+                and local->second.segment->contains(item))
+            {
+                local->second.segment->destroyItem(item);
+            }
+            else
+            {
+                mPool->destroyRemote(item);
+            }
+        }
+
+    protected:
+        Cache(PolyPoolConcurrent<Root>* pool, Shard* shard)
+            : mPool(pool)
+            , mShard(shard)
+        {
+        }
+
+        PolyPoolConcurrent<Root>* mPool;
+        Shard* mShard;
+    };
+
+    PolyPoolConcurrent()
+        : PolyPoolConcurrent(PolyPoolMemoryResource::defaultResource())
+    {
+    }
+
+    /** Pool drawing all its memory, for objects and bookkeeping alike,
+        from a resource, which must outlive the pool. Caches allocate
+        blocks without locking, so the resource must be safe to use
+        from several threads.
+     */
+    explicit PolyPoolConcurrent(PolyPoolMemoryResource* resource)
+        : mShards(resource)
+        , mIdleShards(resource)
+        , mSegments(resource)
+        , mRemoteFrees(resource)
+        , mBlockOwners(resource)
+        , mResource(resource)
+    {
+    }
+
+    explicit PolyPoolConcurrent(size_type defaultBlockSize,
+                                PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : PolyPoolConcurrent(resource)
+    {
+        mDefaultBlockSize = defaultBlockSize;
+    }
+    /** Same, for literal block sizes: without it, PolyPoolConcurrent(0) would be
+        ambiguous with the resource constructor. Negative sizes are
+        taken as zero.
+     */
+    explicit PolyPoolConcurrent(int defaultBlockSize,
+                                PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : PolyPoolConcurrent(size_type(defaultBlockSize > 0 ? defaultBlockSize : 0), resource)
+    {
+    }
+
+    PolyPoolConcurrent(const PolyPoolConcurrent&) = delete;
+    PolyPoolConcurrent& operator=(const PolyPoolConcurrent&) = delete;
+
+    ~PolyPoolConcurrent()
+    {
+        // Pending remote destroys have already been destructed.
+        collect();
+    }
+
+    /// Take a cache for the calling thread.
+    Cache cache()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mIdleShards.empty())
+        {
+            mShards.push_back(mResource->create<Shard>(mResource));
+            return Cache(this, mShards.back().get());
+        }
+        Shard* shard = mIdleShards.back();
+        mIdleShards.pop_back();
+        return Cache(this, shard);
+    }
+
+    /// Set the block size of segments created from now on.
+    void setDefaultBlockSize(size_type size)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDefaultBlockSize = size;
+    }
+
+    /** Free the slots of all objects destroyed by threads other than
+        their owner. Must only be called while no cache is in use.
+     */
+    void collect()
+    {
+        mBlockOwners.reclaim();
+        for (auto& shard : mShards)
+        {
+            for (auto& local : shard->segments)
+            {
+                collect(local.second);
+            }
+        }
+    }
+
+    /// Number of active items. See collect() for restrictions.
+    size_type active()
+    {
+        collect();
+        size_type size = 0;
+        for (auto& segment : mSegments)
+        {
+            size += segment->active();
+        }
+        return size;
+    }
+
+    /// Number of free items. See collect() for restrictions.
+    size_type holes()
+    {
+        collect();
+        size_type size = 0;
+        for (auto& segment : mSegments)
+        {
+            size += segment->holes();
+        }
+        return size;
+    }
+
+    /// Total number of items, active + free + spare.
+    size_type capacity()
+    {
+        size_type size = 0;
+        for (auto& segment : mSegments)
+        {
+            size += segment->capacity();
+        }
+        return size;
+    }
+
+    /// Number of blocks.
+    size_type blocks()
+    {
+        size_type size = 0;
+        for (auto& segment : mSegments)
+        {
+            size += segment->blocks();
+        }
+        return size;
+    }
+
+    /** Call f on every active object, with Root&.
+        See collect() for restrictions.
+     */
+    template <typename F>
+    void for_each(F&& f)
+    {
+        collect();
+        for (auto& segment : mSegments)
+        {
+            segment->forEachRoot(f);
+        }
+    }
+
+    /// See collect() for restrictions.
+    PolyPoolIterator<Root> begin()
+    {
+        collect();
+        PolyPoolIterator<Root> iter(&mSegments, 0);
+        iter.seekActive();
+        return iter;
+    }
+    PolyPoolIterator<Root> end()
+    {
+        return PolyPoolIterator<Root>(&mSegments, mSegments.size());
+    }
+
+    /** Deallocate blocks with only free objects.
+        See collect() for restrictions.
+     */
+    void shrink_to_fit()
+    {
+        collect();
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBlockOwners.clear();
+        for (auto& shard : mShards)
+        {
+            for (auto& local : shard->segments)
+            {
+                local.second.segment->shrink_to_fit();
+                local.second.blocks = 0;
+                publishLocked(local.second);
+            }
+        }
+    }
+
+protected:
+    /// Guards everything below but the segments' contents.
+    std::mutex mMutex;
+    PolyPoolVector<PolyPoolOwner<Shard> > mShards;
+    PolyPoolVector<Shard*> mIdleShards;
+    /// Every segment of every shard.
+    segment_list mSegments;
+    PolyPoolVector<PolyPoolOwner<RemoteFrees> > mRemoteFrees;
+    /// Maps every published block to its segment's remote frees.
+    /// Read without locking.
+    PolyPoolOwnerMap<RemoteFrees> mBlockOwners;
+    size_type mDefaultBlockSize = 20;
+    PolyPoolMemoryResource* mResource;
+
+    template <typename Child>
+    Local& local(Shard& shard)
+    {
+        auto local = shard.segments.find(typeid(Child));
+        if (local != shard.segments.end()) return local->second;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mSegments.push_back(mResource->create<PolyPoolSegmentBase<Root>, PolyPoolSegment<Child, Root> >(
+            mDefaultBlockSize, mResource));
+        mRemoteFrees.push_back(mResource->create<RemoteFrees>(mSegments.back().get()));
+        Local created{mSegments.back().get(), mRemoteFrees.back().get(), 0};
+        return shard.segments.emplace(typeid(Child), created).first->second;
+    }
+
+    void release(Shard* shard)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mIdleShards.push_back(shard);
+    }
+
+    /// Add blocks created by a cache to the block directory.
+    void publish(Local& local)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        publishLocked(local);
+    }
+    void publishLocked(Local& local)
+    {
+        const auto& blocks = local.segment->mBlocks;
+        for (; local.blocks < blocks.size(); local.blocks++)
+        {
+            const auto& block = blocks[local.blocks];
+            mBlockOwners.push_back(block.data, block.capacity() * local.segment->mStride, local.remote);
+        }
+    }
+
+    /// Free the slots destroyed remotely in a cache's segment.
+    void collect(Local& local)
+    {
+        void* slot = local.remote->takeAll();
+        while (slot)
+        {
+            void* next;
+            std::memcpy(&next, slot, sizeof(next));
+            local.segment->releaseSlot(slot);
+            slot = next;
+        }
+    }
+
+    void destroyRemote(Root* item)
+    {
+        RemoteFrees* remote = mBlockOwners.find(item);
+        if (not remote) throw std::invalid_argument("Object is not stored by this PolyPoolConcurrent.");
+        remote->push(remote->segment->destructItem(item));
+    }
+
+private:
+};
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "PolyPoolMemory.h"
+
+/** Small work-stealing thread pool used by parallel_for_each().
+
+    Each thread, including the one calling run(), owns a task queue.
+    Threads pop tasks from the back of their own queue and, once it is
+    empty, steal from the front of the others. A batch of tasks is
+    dealt round-robin over the queues, so threads start on their own
+    share and only contend when the work turns out uneven.
+
+    Worker threads sleep between batches. Batches submitted from
+    several threads at once run one after the other. A batch submitted
+    from within a task, such as a nested parallel_for_each(), runs
+    inline on the thread running that task, since waiting for the
+    current batch to finish would never end.
+ */
+class PolyPoolExecutor
+{
+public:
+    using size_type=std::size_t;
+    using task=std::function<void()>;
+    /// A batch of tasks, allocated from the resource of the pool submitting it.
+    using task_list=PolyPoolVector<task>;
+
+    /// Create an executor with the given number of worker threads.
+    explicit PolyPoolExecutor(size_type workers = defaultWorkers())
+        : mQueues(workers + 1)
+    {
+        for (size_type queue = 1; queue <= workers; queue++)
+        {
+            mThreads.emplace_back([this, queue] { work(queue); });
+        }
+    }
+
+    PolyPoolExecutor(const PolyPoolExecutor&) = delete;
+    PolyPoolExecutor& operator=(const PolyPoolExecutor&) = delete;
+
+    ~PolyPoolExecutor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mWake.notify_all();
+        for (auto& thread : mThreads)
+        {
+            thread.join();
+        }
+    }
+
+    /// Executor shared by all pools, with a worker per extra core.
+    static PolyPoolExecutor& shared()
+    {
+        static PolyPoolExecutor executor;
+        return executor;
+    }
+
+    /// Number of threads running tasks, including the caller of run().
+    size_type threads() const
+    {
+        return mQueues.size();
+    }
+
+    /** Run a batch of tasks and wait for all of them to finish.
+
+        The calling thread runs tasks too. If any task throws, the
+        first exception is rethrown once the batch is done. Called from
+        within a task, of this or any other executor, the tasks run one
+        after the other on the calling thread.
+     */
+    void run(task_list& tasks)
+    {
+        if (tasks.empty()) return;
+        if (insideTask())
+        {
+            runInline(tasks);
+            return;
+        }
+
+        std::lock_guard<std::mutex> running(mRunMutex);
+        mError = nullptr;
+        mRemaining = tasks.size();
+        for (size_type index = 0; index < tasks.size(); index++)
+        {
+            Queue& queue = mQueues[index % mQueues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(tasks[index]));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            ++mBatch;
+        }
+        mWake.notify_all();
+
+        while (runOne(0))
+        {
+        }
+        // No tasks are left queued, wait for those still running.
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mDone.wait(lock, [this] { return mRemaining == 0; });
+        }
+        if (mError) std::rethrow_exception(mError);
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    std::vector<Queue> mQueues;
+    std::vector<std::thread> mThreads;
+
+    /// Serializes batches.
+    std::mutex mRunMutex;
+    /// Guards batch start, completion and shutdown.
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+    size_type mBatch = 0;
+    bool mStopping = false;
+
+    std::atomic<size_type> mRemaining{0};
+    std::mutex mErrorMutex;
+    std::exception_ptr mError;
+
+    static size_type defaultWorkers()
+    {
+        const size_type cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 0;
+    }
+
+    /// Whether the calling thread is running a task.
+    static bool& insideTask()
+    {
+        static thread_local bool inside = false;
+        return inside;
+    }
+
+    /// Run a batch submitted from within a task.
+    static void runInline(task_list& tasks)
+    {
+        std::exception_ptr error;
+        for (auto& current : tasks)
+        {
+            try
+            {
+                current();
+            }
+            catch (...)
+            {
+                if (not error) error = std::current_exception();
+            }
+        }
+        if (error) std::rethrow_exception(error);
+    }
+
+    /// Run a task from the own queue or a stolen one. False if none.
+    bool runOne(size_type self)
+    {
+        task current;
+        if (not pop(self, current) and not steal(self, current)) return false;
+
+        insideTask() = true;
+        try
+        {
+            current();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mErrorMutex);
+            if (not mError) mError = std::current_exception();
+        }
+        insideTask() = false;
+        if (--mRemaining == 0)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mDone.notify_all();
+        }
+        return true;
+    }
+
+    bool pop(size_type self, task& current)
+    {
+        Queue& queue = mQueues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        current = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_type self, task& current)
+    {
+        for (size_type offset = 1; offset < mQueues.size(); offset++)
+        {
+            Queue& queue = mQueues[(self + offset) % mQueues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            current = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_type self)
+    {
+        size_type seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWake.wait(lock, [&] { return mStopping or mBatch != seen; });
+                if (mStopping) return;
+                seen = mBatch;
+            }
+            while (runOne(self))
+            {
+            }
+        }
+    }
+};
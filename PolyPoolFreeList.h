@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+/** Intrusive list of free slots.
+
+    The link to the next free slot is stored inside the dead slot
+    itself, so pushing and popping are O(1) and never allocate.
+
+    Only slots at least as large as a pointer can be linked, which
+    segments check against their layout's stride. Layouts pad items
+    smaller than a pointer accordingly, see PolyPoolLayout.
+
+    WARNING: Pushing a slot overwrites the start of its storage, so
+    the object it held must not be used again until the slot is
+    popped and constructed into.
+ */
+class PolyPoolFreeList
+{
+public:
+    using size_type=std::size_t;
+
+    void push(void* slot)
+    {
+        std::memcpy(slot, &mHead, sizeof(mHead));
+        mHead = slot;
+        ++mSize;
+    }
+
+    /// Pop the most recently freed slot, or nullptr if empty.
+    void* pop()
+    {
+        void* slot = mHead;
+        if (slot)
+        {
+            std::memcpy(&mHead, slot, sizeof(mHead));
+            --mSize;
+        }
+        return slot;
+    }
+
+    bool empty() const
+    {
+        return mSize == 0;
+    }
+
+    /// Number of free slots, kept exact by a counter.
+    size_type size() const
+    {
+        return mSize;
+    }
+
+    /// Forget all free slots. The slots themselves are untouched.
+    void clear()
+    {
+        mHead = nullptr;
+        mSize = 0;
+    }
+
+private:
+    void* mHead = nullptr;
+    size_type mSize = 0;
+};
+
+
+/** Which free slot a segment reuses for a new item.
+
+    - lifo: the most recently freed slot, which is likely still in
+      cache. Cheapest, but after churn reused slots are scattered
+      over all blocks.
+    - lowestSlot: the free slot earliest in storage order, that is
+      in the first block with holes, at the lowest address within
+      it. Live items gather at the front of the segment, so trailing
+      blocks empty out for shrink_to_fit() and iteration stays dense
+      without defragmenting.
+    - currentBlock: a free slot in the block the previous item went
+      to, if any, else as lowestSlot. Items added together stay
+      together.
+
+    The ordered policies find free slots by scanning bitmaps of one
+    bit per slot and per block.
+ */
+enum class PolyPoolReuse
+{
+    lifo,
+    lowestSlot,
+    currentBlock,
+};
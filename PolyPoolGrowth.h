@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+/** How a segment picks the capacity of each new block.
+
+    - fixed(size): every block holds size items. Block sizes convert
+      implicitly to this policy, so anything taking a policy also
+      takes a block size.
+    - geometric(first, max): the first block holds first items and
+      each further one grows the segment's capacity by factor, up to
+      max items per block. factor must exceed 1, else
+      std::invalid_argument is thrown. Doubling keeps the number of blocks, and
+      so the cost of walking them, logarithmic in the population.
+    - custom(next): next(blocks, capacity) returns the capacity of the
+      next block, given the number of blocks and items so far.
+ */
+class PolyPoolGrowth
+{
+public:
+    using size_type=std::size_t;
+    using callback=std::function<size_type(size_type blocks, size_type capacity)>;
+
+    PolyPoolGrowth(size_type blockSize = 20)
+        : mFirst(blockSize)
+        , mMax(blockSize)
+    {
+    }
+
+    static PolyPoolGrowth fixed(size_type blockSize)
+    {
+        return PolyPoolGrowth(blockSize);
+    }
+    static PolyPoolGrowth geometric(size_type first, size_type max, double factor = 2.0)
+    {
+        if (not (factor > 1.0)) throw std::invalid_argument("Geometric growth factor must exceed 1.");
+        PolyPoolGrowth growth(first);
+        growth.mMax = std::max(first, max);
+        growth.mFactor = factor;
+        return growth;
+    }
+    static PolyPoolGrowth custom(callback next)
+    {
+        PolyPoolGrowth growth;
+        growth.mNext = std::move(next);
+        return growth;
+    }
+
+    /// Capacity of the next block of a segment, never zero.
+    size_type next(size_type blocks, size_type capacity) const
+    {
+        if (mNext) return std::max(mNext(blocks, capacity), size_type(1));
+        if (blocks == 0 or mFirst == mMax) return std::max(mFirst, size_type(1));
+
+        // Capped as a double, as the product may not fit a size_type.
+        const double grown = std::min(double(capacity) * (mFactor - 1.0), double(mMax));
+        return std::max(std::min(size_type(grown), mMax), mFirst);
+    }
+
+private:
+    size_type mFirst;
+    size_type mMax;
+    double mFactor = 1.0;
+    callback mNext;
+};
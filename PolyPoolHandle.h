@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+/** A generational reference to an item of type Child.
+
+    Unlike a pointer, a handle survives its item being moved by
+    defragment(), and resolves to nullptr once the item is destroyed or
+    freed, even if its slot has been reused since.
+
+    A handle holds an index into its segment's handle table and the
+    generation of that table entry when the handle was issued. Each
+    time an item is destroyed, the generation of its entry is bumped,
+    making all outstanding handles to it stale. Resolving is a single
+    table lookup and comparison.
+
+    Handles are issued by and resolved against the pool that holds the
+    item. Handles issued before a type's segment is dropped by clear()
+    on an open-world pool must not be resolved afterwards.
+ */
+template <typename Child>
+class PolyPoolHandle
+{
+    template <typename, typename>
+    friend class PolyPoolSegment;
+
+public:
+    using index_type=std::uint32_t;
+
+    static const index_type none = ~index_type(0);
+
+    /// A null handle, which never resolves to an item.
+    PolyPoolHandle() = default;
+
+    /// Whether the handle was issued for an item, live or not.
+    explicit operator bool() const
+    {
+        return mIndex != none;
+    }
+
+    bool operator==(const PolyPoolHandle<Child>& rhs) const
+    {
+        return mIndex == rhs.mIndex and mGeneration == rhs.mGeneration;
+    }
+    bool operator!=(const PolyPoolHandle<Child>& rhs) const
+    {
+        return not (*this == rhs);
+    }
+
+protected:
+    PolyPoolHandle(index_type index, index_type generation)
+        : mIndex(index)
+        , mGeneration(generation)
+    {
+    }
+
+    index_type mIndex = none;
+    index_type mGeneration = 0;
+};
+
+template <typename Child>
+const typename PolyPoolHandle<Child>::index_type PolyPoolHandle<Child>::none;
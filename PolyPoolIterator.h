@@ -1,219 +1,268 @@
 #pragma once
 
-#include <iostream>
+#include <cstddef>
 #include <iterator>
+#include <memory>
+#include <vector>
 
-#include <unordered_map>
-#include <unordered_set>
+#include "PolyPoolMemory.h"
 
-#include "boost/poly_collection/base_collection.hpp"
+template <typename Root>
+class PolyPoolSegmentBase;
+template <typename Child, typename Root>
+class PolyPoolSegment;
 
 /** A whole-collection iterator.
 
-    See PolyPoolLocalIterator to iterate a single sub-type.
+    Bidirectional, so std::reverse_iterator walks the pool backwards,
+    see PolyPool::rbegin(). See PolyPoolLocalIterator to iterate a
+    single sub-type.
 
-    OPTIMIZE: May be faster to keep list of used items?
-
-    TODO: Change ValueType -> Root.
+    Segments is the pool's list of segments, indexed to give pointers
+    to PolyPoolSegmentBase<Root>: owners for the open-world pool, and
+    plain pointers into the tuple for the closed-world pool.
  */
-template <typename Root>
-class PolyPoolIterator : public std::iterator<std::forward_iterator_tag, Root>
+template <typename Root,
+          typename Segments = PolyPoolVector<PolyPoolOwner<PolyPoolSegmentBase<Root> > > >
+class PolyPoolIterator
 {
-    template <typename>
+    template <typename, typename>
     friend class PolyPoolIterator;
-    template<typename>
+    template<typename, typename...>
     friend class PolyPool;
+    template <typename>
+    friend class PolyPoolConcurrent;
 
-    using iterator=PolyPoolIterator<Root>;
-
-    using base_collection_iterator=typename boost::base_collection<Root>::iterator;
-    using block_list=std::vector<boost::base_collection<Root> >;
-    using block_list_iterator=typename std::vector<boost::base_collection<Root> >::iterator;
-    using free_items_map=std::unordered_map<std::type_index, std::unordered_set<Root*> >;
-
-    base_collection_iterator mIter;
-    block_list_iterator mCurrentBlock;
+    using iterator=PolyPoolIterator<Root, Segments>;
+    using segment_list=Segments;
 
-    block_list& mBlocks;
-    free_items_map& mFreeItems;
+    // Items are visited segment by segment so that the type of each
+    // item is known without inspecting it, as free items are dead.
+    const segment_list* mSegments;
+    std::size_t mSegment;
+    std::size_t mBlock = 0;
+    std::size_t mSlot = 0;
 
 public:
-    // PolyPoolIterator(const PolyPoolIterator& iter)
-    //     : mIter(iter.mIter)
-    // {
-    // }
+    using iterator_category=std::bidirectional_iterator_tag;
+    using value_type=Root;
+    using difference_type=std::ptrdiff_t;
+    using pointer=Root*;
+    using reference=Root&;
 
     iterator& operator++()
     {
-        // Seek next non-free element, jumping from block to block as
-        // needed.
-        do
-        {
-            ++mIter;
-
-            // Advance to next block.
-            if (mIter == mCurrentBlock->end()
-                and mCurrentBlock != mBlocks.end() - 1)
-            {
-                ++mCurrentBlock;
-                mIter = mCurrentBlock->begin();
-            }
-        } while (mIter != mBlocks.back().end()
-                 and mFreeItems[typeid(*mIter)].count(&(*mIter)));
-
+        ++mSlot;
+        seekActive();
         return *this;
     }
+    iterator operator++(int)
+    {
+        iterator previous = *this;
+        ++*this;
+        return previous;
+    }
 
-#if 0
     iterator& operator--()
     {
-        // Seek previous non-free element.
-        do
-        {
-            //FIXME: poly_collection::iterator does not seem to support reverse.
-            --mIter;
-
-            // Move to previous block.
-            if (mIter == mCurrentBlock->begin()
-                and mCurrentBlock != mBlocks.begin())
-            {
-                --mCurrentBlock;
-                mIter = mCurrentBlock->end();
-            }
-        } while (mIter != mBlocks.begin().begin()
-                 and mFreeItems[typeid(*mIter)].count(&(*mIter)));
+        seekActiveBackward();
         return *this;
     }
-#endif
-
-    //TODO: prefix operators
-    // PolyPoolIterator<Root> operator++(Root)
-    // {
-    //     PolyPoolIterator<Root> tmp(*this);
-    //     operator++();
-    //     return tmp;
-    // }
-    // PolyPoolIterator<Root> operator--(???)
-    // {
-    // }
+    iterator operator--(int)
+    {
+        iterator previous = *this;
+        --*this;
+        return previous;
+    }
 
-    bool operator==(const iterator& rhs)
+    bool operator==(const iterator& rhs) const
     {
-        return mIter == rhs.mIter;
+        return mSegment == rhs.mSegment
+            and mBlock == rhs.mBlock
+            and mSlot == rhs.mSlot;
     }
 
-    bool operator!=(const iterator& rhs)
+    bool operator!=(const iterator& rhs) const
     {
-        return mIter != rhs.mIter;
+        return not (*this == rhs);
     }
 
-    Root& operator*()
+    Root& operator*() const
     {
-        return *mIter;
+        return *(*mSegments)[mSegment]->rootItem(mBlock, mSlot);
     }
 
-    Root* operator->()
+    Root* operator->() const
     {
-        return &(*mIter);
+        return (*mSegments)[mSegment]->rootItem(mBlock, mSlot);
     }
 
 protected:
-    PolyPoolIterator(base_collection_iterator& iter,
-                     block_list_iterator currentBlock,
-                     block_list& blocks,
-                     free_items_map& freeItems)
-        : mIter(iter)
-        , mCurrentBlock(currentBlock)
-        , mBlocks(blocks)
-        , mFreeItems(freeItems)
+    PolyPoolIterator(const segment_list* segments, std::size_t segment)
+        : mSegments(segments)
+        , mSegment(segment)
     {
+    }
 
+    /// Seek the first live item at or after the current position,
+    /// skipping runs of free items and jumping from block to block
+    /// and segment to segment as needed.
+    void seekActive()
+    {
+        for (; mSegment < mSegments->size(); ++mSegment, mBlock = 0)
+        {
+            const auto& blocks = (*mSegments)[mSegment]->mBlocks;
+            for (; mBlock < blocks.size(); ++mBlock, mSlot = 0)
+            {
+                mSlot = blocks[mBlock].live.findNext(mSlot);
+                if (mSlot < blocks[mBlock].live.size()) return;
+            }
+        }
+        mSlot = 0;
+    }
+
+    /// Seek the last live item before the current position. The
+    /// iterator must not be at the first live item.
+    void seekActiveBackward()
+    {
+        for (;;)
+        {
+            if (mSegment < mSegments->size())
+            {
+                const auto& blocks = (*mSegments)[mSegment]->mBlocks;
+                if (mBlock < blocks.size())
+                {
+                    const std::size_t slot = blocks[mBlock].live.findPrev(mSlot);
+                    if (slot < blocks[mBlock].live.size())
+                    {
+                        mSlot = slot;
+                        return;
+                    }
+                }
+                if (mBlock > 0)
+                {
+                    --mBlock;
+                    mSlot = blocks[mBlock].live.size();
+                    continue;
+                }
+            }
+            // Start from past the last block of the previous segment.
+            --mSegment;
+            mBlock = (*mSegments)[mSegment]->mBlocks.size();
+            mSlot = 0;
+        }
     }
 private:
 };
 
 
-/** A type-specific iterator.
+/** A type-specific iterator, bidirectional like PolyPoolIterator.
  */
 template <typename Child, typename Root>
-class PolyPoolLocalIterator : public std::iterator<std::forward_iterator_tag, Root>
+class PolyPoolLocalIterator
 {
     template <typename,typename>
     friend class PolyPoolLocalIterator;
-    template<typename>
-    friend class PolyPool;
+    template <typename,typename>
+    friend class PolyPoolSegment;
 
     using local_iterator=PolyPoolLocalIterator<Child, Root>;
 
-    using base_collection_local_iterator=typename boost::base_collection<Root>::template local_iterator<Child>;
-    using block_list=std::vector<boost::base_collection<Root> >;
-    using block_list_iterator=typename std::vector<boost::base_collection<Root> >::iterator;
-    using free_items=std::unordered_set<Root*>;
-
-    base_collection_local_iterator mIter;
-    block_list_iterator mCurrentBlock;
-    block_list_iterator& mLastBlock;
-    block_list& mBlocks; //TODO: May not need this for local iters.
-    free_items& mFreeItems;
+    PolyPoolSegment<Child, Root>* mSegment;
+    std::size_t mBlock;
+    std::size_t mSlot;
 
 public:
+    using iterator_category=std::bidirectional_iterator_tag;
+    using value_type=Child;
+    using difference_type=std::ptrdiff_t;
+    using pointer=Child*;
+    using reference=Child&;
+
     local_iterator& operator++()
     {
-        // Seek next non-free element, jumping from block to block as
-        // needed.
-        do
-        {
-            ++mIter;
-
-            // Advance to next block.
-            if (mIter == mCurrentBlock->template end<Child>()
-                and mCurrentBlock != mLastBlock)
-            {
-                ++mCurrentBlock;
-                mIter = mCurrentBlock->template begin<Child>();
-            }
-        } while (mIter != mLastBlock->template end<Child>()
-                 and mFreeItems.count(&(*mIter)));
-
+        ++mSlot;
+        seekActive();
         return *this;
     }
+    local_iterator operator++(int)
+    {
+        local_iterator previous = *this;
+        ++*this;
+        return previous;
+    }
 
-    //TODO: reverse operator
-    //TODO: prefix operators
+    local_iterator& operator--()
+    {
+        seekActiveBackward();
+        return *this;
+    }
+    local_iterator operator--(int)
+    {
+        local_iterator previous = *this;
+        --*this;
+        return previous;
+    }
 
-    bool operator==(const local_iterator& rhs)
+    bool operator==(const local_iterator& rhs) const
     {
-        return mIter == rhs.mIter;
+        return mBlock == rhs.mBlock and mSlot == rhs.mSlot;
     }
 
-    bool operator!=(const local_iterator& rhs)
+    bool operator!=(const local_iterator& rhs) const
     {
-        return mIter != rhs.mIter;
+        return not (*this == rhs);
     }
 
-    Child& operator*()
+    Child& operator*() const
     {
-        return *mIter;
+        return *mSegment->item(mBlock, mSlot);
     }
 
-    Child* operator->()
+    Child* operator->() const
     {
-        return &(*mIter);
+        return mSegment->item(mBlock, mSlot);
     }
 
 protected:
-    PolyPoolLocalIterator(base_collection_local_iterator& iter,
-                          block_list_iterator currentBlock,
-                          block_list_iterator& lastBlock,
-                          block_list& blocks,
-                          free_items& freeItems)
-        : mIter(iter)
-        , mCurrentBlock(currentBlock)
-        , mLastBlock(lastBlock)
-        , mBlocks(blocks)
-        , mFreeItems(freeItems)
+    PolyPoolLocalIterator(PolyPoolSegment<Child, Root>* segment,
+                          std::size_t block,
+                          std::size_t slot)
+        : mSegment(segment)
+        , mBlock(block)
+        , mSlot(slot)
+    {
+    }
+
+    /// Seek the first live item at or after the current position,
+    /// skipping runs of free items and jumping from block to block as
+    /// needed.
+    void seekActive()
     {
+        const auto& blocks = mSegment->mBlocks;
+        for (; mBlock < blocks.size(); ++mBlock, mSlot = 0)
+        {
+            mSlot = blocks[mBlock].live.findNext(mSlot);
+            if (mSlot < blocks[mBlock].live.size()) return;
+        }
+        mSlot = 0;
+    }
 
+    /// Seek the last live item before the current position. The
+    /// iterator must not be at the first live item.
+    void seekActiveBackward()
+    {
+        const auto& blocks = mSegment->mBlocks;
+        if (mBlock == blocks.size())
+        {
+            --mBlock;
+            mSlot = blocks[mBlock].live.size();
+        }
+        for (;; --mBlock, mSlot = blocks[mBlock].live.size())
+        {
+            mSlot = blocks[mBlock].live.findPrev(mSlot);
+            if (mSlot < blocks[mBlock].live.size()) return;
+        }
     }
 
 private:
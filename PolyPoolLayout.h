@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+/// Stride of tightly packed slots: sizeof(Child), rounded up to a
+/// multiple of alignof(Child) that holds a pointer.
+template <typename Child>
+struct PolyPoolPackedStride
+{
+    static constexpr std::size_t value =
+        sizeof(Child) >= sizeof(void*)
+            ? sizeof(Child)
+            : (sizeof(void*) + alignof(Child) - 1) / alignof(Child) * alignof(Child);
+};
+
+template <typename Child>
+constexpr std::size_t PolyPoolPackedStride<Child>::value;
+
+/** Whether Child reaches Root without virtual inheritance, so that
+    converting pointers between them only adds a constant. Segments
+    rely on it to find the root of an item from its slot and back.
+ */
+template <typename Root, typename Child>
+class PolyPoolFixedRootOffset
+{
+    template <typename R, typename C>
+    static auto test(int) -> decltype(static_cast<C*>(std::declval<R*>()), std::true_type());
+    template <typename, typename>
+    static std::false_type test(long);
+
+public:
+    static constexpr bool value = decltype(test<Root, Child>(0))::value;
+};
+
+template <typename Root, typename Child>
+constexpr bool PolyPoolFixedRootOffset<Root, Child>::value;
+
+/** Placement of the items of type Child within blocks.
+
+    stride() is the distance between consecutive slots, and
+    alignment() that of the start of every block. By default items
+    are packed tightly, and blocks are aligned for the type, so
+    types declared alignas(32) or alignas(64) get exactly that.
+
+    Free slots hold the link of the free list, see PolyPoolFreeList,
+    so a stride is never less than a pointer: items smaller than that
+    are padded up to it.
+
+    Specialize to opt a type into another layout, usually by deriving
+    from one of the layouts below. The specialization must be visible
+    wherever items of the type are added to a pool:
+
+        template <>
+        struct PolyPoolLayout<Particle> : PolyPoolPaddedLayout<Particle>
+        {
+        };
+ */
+template <typename Child>
+struct PolyPoolLayout
+{
+    static constexpr std::size_t stride()
+    {
+        return PolyPoolPackedStride<Child>::value;
+    }
+    static constexpr std::size_t alignment()
+    {
+        return alignof(Child);
+    }
+};
+
+/** Every slot starts on a cache line of its own and is padded to
+    whole cache lines, so items updated by different threads never
+    share a line.
+ */
+template <typename Child, std::size_t CacheLine = 64>
+struct PolyPoolPaddedLayout
+{
+    static constexpr std::size_t stride()
+    {
+        return (sizeof(Child) + alignment() - 1) / alignment() * alignment();
+    }
+    static constexpr std::size_t alignment()
+    {
+        return alignof(Child) > CacheLine ? alignof(Child) : CacheLine;
+    }
+};
+
+/** Slots are packed tightly, but every block starts on a cache line,
+    so runs of items line up the same way in every block.
+ */
+template <typename Child, std::size_t CacheLine = 64>
+struct PolyPoolAlignedLayout
+{
+    static constexpr std::size_t stride()
+    {
+        return PolyPoolPackedStride<Child>::value;
+    }
+    static constexpr std::size_t alignment()
+    {
+        return alignof(Child) > CacheLine ? alignof(Child) : CacheLine;
+    }
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "PolyPoolMemory.h"
+
+/** Memory resource handing out blocks from one large range of virtual
+    memory, reserved up front with mmap. POSIX only.
+
+    Pages of the range are only committed by the system once first
+    touched, so reserving far more than needed is cheap. Blocks of a
+    segment thus end up next to each other instead of scattered over
+    the heap, and optionally on transparent huge pages, which greatly
+    extends the reach of the TLB when iterating.
+
+    Deallocated blocks stay mapped, so their addresses stay valid for
+    reuse, but their pages are given back to the system with
+    MADV_DONTNEED. Memory use thus drops after shrink_to_fit() or
+    clear() even though the range is kept. Freed blocks are reused by
+    later blocks of the same size or smaller; neighbouring free blocks
+    are not merged.
+
+    Only requests of at least a page are served from the range, rounded
+    up to whole pages. Smaller ones, which is most bookkeeping, go to
+    an upstream resource. Choose block sizes spanning whole pages to
+    avoid waste, see setDefaultBlockSize().
+
+    Give each type its own resource, see setBlockResource(), for each
+    type's blocks to be contiguous. The resource is safe to use from
+    several threads.
+ */
+class PolyPoolMappedResource : public PolyPoolMemoryResource
+{
+public:
+    /// Size of a transparent huge page on common platforms.
+    static size_type hugePageSize()
+    {
+        return size_type(2) << 20;
+    }
+
+    /** Reserve a range of the given size, rounded up to whole pages.
+        With hugePages set, the range is aligned to and advised for
+        transparent huge pages where supported.
+        Throws std::bad_alloc if the range cannot be reserved.
+     */
+    explicit PolyPoolMappedResource(size_type reserve, bool hugePages = false,
+                                    PolyPoolMemoryResource* upstream = defaultResource())
+        : mUpstream(upstream)
+        , mPageSize(size_type(sysconf(_SC_PAGESIZE)))
+    {
+        const size_type alignment = hugePages ? hugePageSize() : mPageSize;
+        mReserved = roundUp(reserve, alignment);
+        // Over-reserve so the range can be aligned, then trim.
+        const size_type mapped = mReserved + alignment - mPageSize;
+        void* range = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (range == MAP_FAILED) throw std::bad_alloc();
+
+        const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(range);
+        const std::uintptr_t aligned = roundUp(start, alignment);
+        if (aligned != start)
+        {
+            munmap(range, aligned - start);
+        }
+        const size_type tail = mapped - (aligned - start) - mReserved;
+        if (tail)
+        {
+            munmap(reinterpret_cast<unsigned char*>(aligned) + mReserved, tail);
+        }
+        mRange = reinterpret_cast<unsigned char*>(aligned);
+#ifdef MADV_HUGEPAGE
+        if (hugePages) madvise(mRange, mReserved, MADV_HUGEPAGE);
+#endif
+    }
+
+    PolyPoolMappedResource(const PolyPoolMappedResource&) = delete;
+    PolyPoolMappedResource& operator=(const PolyPoolMappedResource&) = delete;
+
+    ~PolyPoolMappedResource()
+    {
+        munmap(mRange, mReserved);
+    }
+
+    /// Size of the reserved range.
+    size_type reserved() const
+    {
+        return mReserved;
+    }
+    /// Part of the range handed out so far, in use or free.
+    size_type used() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mUsed;
+    }
+    /// Part of the range deallocated and released to the system.
+    size_type released() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mReleased;
+    }
+
+protected:
+    PolyPoolMemoryResource* mUpstream;
+    const size_type mPageSize;
+    unsigned char* mRange;
+    size_type mReserved;
+
+    mutable std::mutex mMutex;
+    size_type mUsed = 0;
+    size_type mReleased = 0;
+    /// Deallocated parts of the range, by size.
+    std::multimap<size_type, unsigned char*> mFree;
+
+    static size_type roundUp(size_type size, size_type alignment)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    bool mapped(size_type bytes, size_type alignment) const
+    {
+        return bytes >= mPageSize and alignment <= mPageSize;
+    }
+
+    void* doAllocate(size_type bytes, size_type alignment) override
+    {
+        if (not mapped(bytes, alignment)) return mUpstream->allocate(bytes, alignment);
+
+        bytes = roundUp(bytes, mPageSize);
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto free = mFree.lower_bound(bytes);
+        if (free != mFree.end())
+        {
+            const size_type size = free->first;
+            unsigned char* block = free->second;
+            mFree.erase(free);
+            if (size > bytes) mFree.emplace(size - bytes, block + bytes);
+            mReleased -= bytes;
+            return block;
+        }
+        if (bytes > mReserved - mUsed) throw std::bad_alloc();
+        unsigned char* block = mRange + mUsed;
+        mUsed += bytes;
+        return block;
+    }
+
+    void doDeallocate(void* p, size_type bytes, size_type alignment) override
+    {
+        if (not mapped(bytes, alignment))
+        {
+            mUpstream->deallocate(p, bytes, alignment);
+            return;
+        }
+
+        bytes = roundUp(bytes, mPageSize);
+        madvise(p, bytes, MADV_DONTNEED);
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFree.emplace(bytes, static_cast<unsigned char*>(p));
+        mReleased += bytes;
+    }
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define POLYPOOL_HAS_PMR 1
+#endif
+#endif
+
+template <typename T>
+class PolyPoolDeleter;
+template <typename T>
+using PolyPoolOwner=std::unique_ptr<T, PolyPoolDeleter<T> >;
+
+/** Source of all memory used by a pool.
+
+    Pools allocate their blocks, their segments and the containers
+    they keep track of items in from a memory resource, so that they
+    can be placed in an arena. The interface mirrors
+    std::pmr::memory_resource, which is only available from C++17
+    on; see PolyPoolPmrResource to use one of those.
+
+    The resource must outlive every pool using it.
+ */
+class PolyPoolMemoryResource
+{
+public:
+    using size_type=std::size_t;
+
+    virtual ~PolyPoolMemoryResource() = default;
+
+    void* allocate(size_type bytes, size_type alignment = alignof(std::max_align_t))
+    {
+        return doAllocate(bytes, alignment);
+    }
+    void deallocate(void* p, size_type bytes, size_type alignment = alignof(std::max_align_t))
+    {
+        doDeallocate(p, bytes, alignment);
+    }
+
+    /// Construct a T owned as a Base, with storage from this resource.
+    template <typename Base, typename T = Base, typename... Args>
+    PolyPoolOwner<Base> create(Args&&... args);
+
+    /// Resource used when none is given, backed by operator new.
+    static PolyPoolMemoryResource* defaultResource();
+
+protected:
+    virtual void* doAllocate(size_type bytes, size_type alignment) = 0;
+    virtual void doDeallocate(void* p, size_type bytes, size_type alignment) = 0;
+};
+
+/** Memory resource backed by the global operator new.
+    Honors any alignment. Before C++17, over-aligned requests are
+    served from a larger allocation, whose start is kept just ahead of
+    the aligned storage.
+ */
+class PolyPoolNewDeleteResource : public PolyPoolMemoryResource
+{
+protected:
+    void* doAllocate(size_type bytes, size_type alignment) override
+    {
+        if (alignment <= alignof(std::max_align_t)) return ::operator new(bytes);
+#if __cpp_aligned_new
+        return ::operator new(bytes, std::align_val_t(alignment));
+#else
+        void* start = ::operator new(bytes + alignment + sizeof(void*));
+        const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(start) + sizeof(void*);
+        void* aligned = reinterpret_cast<void*>((first + alignment - 1) / alignment * alignment);
+        std::memcpy(static_cast<unsigned char*>(aligned) - sizeof(void*), &start, sizeof(void*));
+        return aligned;
+#endif
+    }
+    void doDeallocate(void* p, size_type, size_type alignment) override
+    {
+        if (alignment <= alignof(std::max_align_t))
+        {
+            ::operator delete(p);
+            return;
+        }
+#if __cpp_aligned_new
+        ::operator delete(p, std::align_val_t(alignment));
+#else
+        void* start;
+        std::memcpy(&start, static_cast<unsigned char*>(p) - sizeof(void*), sizeof(void*));
+        ::operator delete(start);
+#endif
+    }
+};
+
+inline PolyPoolMemoryResource* PolyPoolMemoryResource::defaultResource()
+{
+    static PolyPoolNewDeleteResource resource;
+    return &resource;
+}
+
+#ifdef POLYPOOL_HAS_PMR
+/// Adapts a std::pmr::memory_resource for use by pools.
+class PolyPoolPmrResource : public PolyPoolMemoryResource
+{
+public:
+    explicit PolyPoolPmrResource(std::pmr::memory_resource* upstream)
+        : mUpstream(upstream)
+    {
+    }
+
+    std::pmr::memory_resource* upstream() const
+    {
+        return mUpstream;
+    }
+
+protected:
+    std::pmr::memory_resource* mUpstream;
+
+    void* doAllocate(size_type bytes, size_type alignment) override
+    {
+        return mUpstream->allocate(bytes, alignment);
+    }
+    void doDeallocate(void* p, size_type bytes, size_type alignment) override
+    {
+        mUpstream->deallocate(p, bytes, alignment);
+    }
+};
+#endif
+
+
+/// Standard allocator drawing from a PolyPoolMemoryResource.
+template <typename T>
+class PolyPoolAllocator
+{
+    template <typename>
+    friend class PolyPoolAllocator;
+
+public:
+    using value_type=T;
+    using propagate_on_container_copy_assignment=std::true_type;
+    using propagate_on_container_move_assignment=std::true_type;
+    using propagate_on_container_swap=std::true_type;
+
+    PolyPoolAllocator()
+        : mResource(PolyPoolMemoryResource::defaultResource())
+    {
+    }
+    PolyPoolAllocator(PolyPoolMemoryResource* resource)
+        : mResource(resource)
+    {
+    }
+    template <typename U>
+    PolyPoolAllocator(const PolyPoolAllocator<U>& other)
+        : mResource(other.mResource)
+    {
+    }
+
+    T* allocate(std::size_t count)
+    {
+        return static_cast<T*>(mResource->allocate(count * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, std::size_t count)
+    {
+        mResource->deallocate(p, count * sizeof(T), alignof(T));
+    }
+
+    PolyPoolMemoryResource* resource() const
+    {
+        return mResource;
+    }
+
+    template <typename U>
+    bool operator==(const PolyPoolAllocator<U>& rhs) const
+    {
+        return mResource == rhs.mResource;
+    }
+    template <typename U>
+    bool operator!=(const PolyPoolAllocator<U>& rhs) const
+    {
+        return mResource != rhs.mResource;
+    }
+
+private:
+    PolyPoolMemoryResource* mResource;
+};
+
+template <typename T>
+using PolyPoolVector=std::vector<T, PolyPoolAllocator<T> >;
+
+
+/** Deleter for objects made by PolyPoolMemoryResource::create().
+    Knows the object's dynamic type, so T need not have a virtual
+    destructor for the storage to be returned with the right size.
+ */
+template <typename T>
+class PolyPoolDeleter
+{
+    friend class PolyPoolMemoryResource;
+
+public:
+    PolyPoolDeleter() = default;
+
+    void operator()(T* object) const
+    {
+        mDestroy(object, mResource);
+    }
+
+protected:
+    PolyPoolMemoryResource* mResource = nullptr;
+    void (*mDestroy)(T*, PolyPoolMemoryResource*) = nullptr;
+
+    template <typename Derived>
+    static void destroy(T* object, PolyPoolMemoryResource* resource)
+    {
+        Derived* derived = static_cast<Derived*>(object);
+        derived->~Derived();
+        resource->deallocate(derived, sizeof(Derived), alignof(Derived));
+    }
+};
+
+template <typename Base, typename T, typename... Args>
+PolyPoolOwner<Base> PolyPoolMemoryResource::create(Args&&... args)
+{
+    void* storage = allocate(sizeof(T), alignof(T));
+    T* object;
+    try
+    {
+        object = new (storage) T(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        deallocate(storage, sizeof(T), alignof(T));
+        throw;
+    }
+    PolyPoolDeleter<Base> deleter;
+    deleter.mResource = this;
+    deleter.mDestroy = &PolyPoolDeleter<Base>::template destroy<T>;
+    return PolyPoolOwner<Base>(object, deleter);
+}
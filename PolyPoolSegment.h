@@ -1,16 +1,1465 @@
-#if 0
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
 #include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-struct PolyPoolSegment
+#include "PolyPoolBitmap.h"
+#include "PolyPoolBlockMap.h"
+#include "PolyPoolBlocks.h"
+#include "PolyPoolExecutor.h"
+#include "PolyPoolFreeList.h"
+#include "PolyPoolGrowth.h"
+#include "PolyPoolHandle.h"
+#include "PolyPoolIterator.h"
+#include "PolyPoolLayout.h"
+#include "PolyPoolMemory.h"
+#include "PolyPoolSnapshot.h"
+#include "PolyPoolStats.h"
+
+/** Storage for the items of a single type, seen through their root
+    type.
+
+    Items live in a list of fixed-capacity blocks of raw storage, so
+    adding blocks never moves existing items. Each block tracks which
+    of its slots hold live items in a bitmap, and only those are ever
+    destructed. Free slots are linked into an intrusive free list and
+    reused before new slots are taken from the block being filled.
+
+    This base does all bookkeeping in terms of raw slots, so PolyPool
+    can hold segments of any type side by side. Anything needing the
+    concrete type, such as constructing and destructing items, lives
+    in PolyPoolSegment and is reached through the few virtual
+    functions below. Type erasure thus stops at the segment boundary:
+    nothing is dispatched per item.
+ */
+template <typename Root>
+class PolyPoolSegmentBase
 {
+    template <typename, typename>
+    friend class PolyPoolIterator;
+    template <typename>
+    friend class PolyPoolConcurrent;
+
+public:
+    using size_type=std::size_t;
+
+    virtual ~PolyPoolSegmentBase()
+    {
+        deallocateBlocks();
+    }
+
+    /// Call item destructor and add it to free list.
+    virtual void destroyItem(Root* item) = 0;
+    /// Add item to free list without calling its destructor.
+    virtual void freeItem(Root* item) = 0;
+    /// Keep item constructed for acquire(), see PolyPoolSegment::release().
+    virtual void releaseItem(Root* item) = 0;
+    /// Destruct and free all items without deallocating memory.
+    virtual void freeAll() = 0;
+    /** Pack live items to the front of the segment, see
+        PolyPoolSegment::defragment(). Segments of types that cannot be
+        move constructed are left as is.
+     */
+    virtual void defragmentItems(const std::function<void(Root*, Root*)>& relocate) = 0;
+    /// Destroy every item for which pred(item) is true, see destroy_if().
+    virtual size_type destroyItemsIf(const std::function<bool(Root&)>& pred) = 0;
+    /// Destroy items given in ascending address order.
+    virtual void destroyItems(Root* const* first, Root* const* last) = 0;
+    /** Call item destructor without freeing its slot.
+        Touches no segment state, so any thread may call it.
+        Returns the item's slot.
+     */
+    virtual void* destructItem(Root* item) = 0;
+    /// Write all blocks and live items to a snapshot, see PolyPool::save().
+    virtual void saveItems(PolyPoolSnapshotWriter& out) const = 0;
+    /** Read blocks and items written by saveItems() into a segment
+        holding no blocks, see PolyPool::load().
+     */
+    virtual void loadItems(const std::shared_ptr<PolyPoolSnapshotFile>& in) = 0;
+
+    /// Destruct all items and deallocate all blocks.
+    void clear()
+    {
+        freeAll();
+        deallocateBlocks();
+        mBlocksReleased += mBlocks.size();
+        mBlocks.clear();
+        mBlockMap.clear();
+        mFreeItems.clear();
+        mHoleBlocks = PolyPoolBitmap(0, mResource);
+        mHoles = 0;
+        mLastBlock = 0;
+        mSize = 0;
+        mCapacity = 0;
+        mSnapshot.reset();
+    }
+
+    /** Deallocate blocks holding only free slots.
+        Free slots in the remaining blocks are kept.
+     */
+    void shrink_to_fit()
+    {
+        discardWarm();
+        size_type kept = 0;
+        for (size_type block = 0; block < mBlocks.size(); block++)
+        {
+            Block& current = mBlocks[block];
+            if (current.live.findNext(0) == current.capacity())
+            {
+                mCapacity -= current.capacity();
+                deallocateBlock(current);
+                ++mBlocksReleased;
+            }
+            else
+            {
+                if (kept != block) mBlocks[kept] = std::move(current);
+                ++kept;
+            }
+        }
+        if (kept == mBlocks.size()) return;
+
+        mBlocks.erase(mBlocks.begin() + kept, mBlocks.end());
+        mBlocks.shrink_to_fit();
+        mBlockMap.clear();
+        for (const Block& block : mBlocks)
+        {
+            mBlockMap.push_back(block.data, block.capacity() * mStride);
+        }
+        rebuildFreeList();
+    }
+
+    bool empty() const
+    {
+        return active() == 0;
+    }
+    /// Number of active items.
+    size_type active() const
+    {
+        return mSize - holes() - warm();
+    }
+    /// Number of free items.
+    size_type holes() const
+    {
+        return mFreeItems.size() + mHoles;
+    }
+    /// Number of released items kept constructed, see release().
+    size_type warm() const
+    {
+        return mWarm.size();
+    }
+    /// Number of active + warm + free items.
+    size_type size() const
+    {
+        return mSize;
+    }
+    /// Total number of items, active + free + spare.
+    size_type capacity() const
+    {
+        return mCapacity;
+    }
+    /// Number of blocks.
+    size_type blocks() const
+    {
+        return mBlocks.size();
+    }
+
+    PolyPoolStats stats() const
+    {
+        PolyPoolStats stats;
+        stats.allocations = mAllocations;
+        stats.reuses = mReuses;
+        stats.blocksCreated = mBlocksCreated;
+        stats.blocksReleased = mBlocksReleased;
+        stats.holesSkipped = mHolesSkipped;
+        stats.blocks = blocks();
+        stats.active = active();
+        stats.holes = holes();
+        stats.warm = warm();
+        stats.capacity = capacity();
+        stats.bytesReserved = capacity() * mStride;
+        stats.bytesLive = active() * mStride;
+        return stats;
+    }
+
+    /// Whether an address lies within one of the segment's blocks.
+    bool contains(const void* item) const
+    {
+        return mBlockMap.find(item) != PolyPoolBlockMap::none;
+    }
+
+    /// Slots handed out, live or free, in the range of a single
+    /// parallel_for_each() task.
+    static const size_type parallelGrain = 4096;
+
+    /** Add tasks calling f on every live item as Root& to a batch.
+        The items are split into ranges of about parallelGrain slots.
+     */
+    template <typename F>
+    void parallelRootTasks(F& f, PolyPoolExecutor::task_list& tasks)
+    {
+        mHolesSkipped += holes();
+        splitSlots([this, &f, &tasks](size_type firstBlock, size_type firstSlot,
+                                      size_type lastBlock, size_type lastSlot)
+        {
+            tasks.push_back([this, &f, firstBlock, firstSlot, lastBlock, lastSlot]
+            {
+                this->forEachRunIn(firstBlock, firstSlot, lastBlock, lastSlot,
+                                   [&](size_type block, size_type first, size_type last)
+                {
+                    for (size_type slot = first; slot < last; slot++)
+                    {
+                        f(*this->rootItem(block, slot));
+                    }
+                });
+            });
+        });
+    }
+
+    /** Call f on every live item as Root&, in storage order.
+        Calls on items go through virtual dispatch. For static types,
+        see PolyPoolSegment::for_each().
+     */
+    template <typename F>
+    void forEachRoot(F&& f)
+    {
+        mHolesSkipped += holes();
+        for (size_type block = 0; block < mBlocks.size(); block++)
+        {
+            const PolyPoolBitmap& live = mBlocks[block].live;
+            for (size_type slot = live.findNext(0); slot < live.size();
+                 slot = live.findNext(slot + 1))
+            {
+                f(*rootItem(block, slot));
+            }
+        }
+    }
+
+    /// Give every newly created block the same capacity.
+    void setBlockSize(size_type size)
+    {
+        mGrowth = PolyPoolGrowth::fixed(size);
+    }
+    /// Capacity of the next block created.
+    size_type blockSize() const
+    {
+        return mGrowth.next(mBlocks.size(), mCapacity);
+    }
+    /// Choose the capacity of newly created blocks by a policy.
+    void setGrowth(PolyPoolGrowth growth)
+    {
+        mGrowth = std::move(growth);
+    }
+
+    /** Draw block storage from a resource other than the one used for
+        bookkeeping, such as a PolyPoolMappedResource.
+        Throws std::logic_error if the segment already has blocks.
+     */
+    void setBlockResource(PolyPoolMemoryResource* resource)
+    {
+        if (not mBlocks.empty())
+        {
+            throw std::logic_error("Cannot change the block resource of a segment holding blocks.");
+        }
+        mBlockResource = resource;
+    }
+
+    /// Choose which free slots new items go to, see PolyPoolReuse.
+    void setReuse(PolyPoolReuse reuse)
+    {
+        if (reuse == mReuse) return;
+        discardWarm();
+        mReuse = reuse;
+        rebuildFreeList();
+    }
+    PolyPoolReuse reuse() const
+    {
+        return mReuse;
+    }
+
+protected:
+    using handle_index=std::uint32_t;
+
+    static const handle_index noHandle = ~handle_index(0);
+
+    struct HandleEntry
+    {
+        /// The item referred to, or nullptr if the entry is free.
+        void* item;
+        handle_index generation;
+    };
+
+    struct Block
+    {
+        unsigned char* data;
+        /// Slots handed out so far, active or free.
+        size_type size;
+        PolyPoolBitmap live;
+        /// Free slots, for the ordered reuse policies only. Allocated
+        /// once the first slot of the block is freed.
+        PolyPoolBitmap holes;
+        size_type holeCount;
+        /// Handle table index of each slot, allocated once the first
+        /// handle to an item of the block is issued.
+        PolyPoolVector<handle_index> handles;
+        /// Whether the storage is part of a loaded snapshot, and so
+        /// not the segment's to deallocate.
+        bool adopted;
+
+        size_type capacity() const
+        {
+            return live.size();
+        }
+    };
+
+    /// Source of the containers below.
+    PolyPoolMemoryResource* mResource;
+    /// Source of block storage.
+    PolyPoolMemoryResource* mBlockResource;
+    PolyPoolVector<Block> mBlocks;
+    /// Finds the block holding an address.
+    PolyPoolBlockMap mBlockMap;
+    /// Free slots, for PolyPoolReuse::lifo.
+    PolyPoolFreeList mFreeItems;
+    /// For the other policies: which blocks have free slots, and how
+    /// many free slots there are in all.
+    PolyPoolBitmap mHoleBlocks;
+    size_type mHoles = 0;
+    PolyPoolReuse mReuse = PolyPoolReuse::lifo;
+    /// The block the previous item went to.
+    size_type mCurrentBlock = 0;
+    /// Released items kept constructed, most recently released last.
+    PolyPoolVector<void*> mWarm;
+    /// The current block being filled.
+    size_type mLastBlock = 0;
+    /// Picks the capacity of new blocks.
+    PolyPoolGrowth mGrowth;
+    /// Distance between consecutive slots.
+    size_type mStride;
+    /// Alignment of block storage.
+    size_type mAlignment;
+    /// Offset of the root subobject within an item.
+    std::ptrdiff_t mRootOffset;
+    size_type mSize = 0;
+    size_type mCapacity = 0;
+    /// Cumulative counters, see PolyPoolStats.
+    size_type mAllocations = 0;
+    size_type mReuses = 0;
+    size_type mBlocksCreated = 0;
+    size_type mBlocksReleased = 0;
+    size_type mHolesSkipped = 0;
+    /// Entries referred to by handles, reused once their item is gone.
+    PolyPoolVector<HandleEntry> mHandles;
+    PolyPoolVector<handle_index> mFreeHandles;
+    /// The snapshot holding adopted blocks, if any.
+    std::shared_ptr<PolyPoolSnapshotFile> mSnapshot;
+
+    PolyPoolSegmentBase(PolyPoolGrowth growth, size_type stride, size_type alignment,
+                        std::ptrdiff_t rootOffset, PolyPoolMemoryResource* resource)
+        : mResource(resource)
+        , mBlockResource(resource)
+        , mBlocks(resource)
+        , mBlockMap(resource)
+        , mHoleBlocks(0, resource)
+        , mWarm(resource)
+        , mGrowth(std::move(growth))
+        , mStride(stride)
+        , mAlignment(alignment)
+        , mRootOffset(rootOffset)
+        , mHandles(resource)
+        , mFreeHandles(resource)
+    {
+    }
+    PolyPoolSegmentBase(PolyPoolSegmentBase&&) = default;
+
+    void* slot(size_type block, size_type slot) const
+    {
+        return mBlocks[block].data + slot * mStride;
+    }
+    Root* rootItem(size_type block, size_type slot) const
+    {
+        return reinterpret_cast<Root*>(mBlocks[block].data + slot * mStride + mRootOffset);
+    }
+
+    /// Find the block holding a slot and the slot's index within it.
+    std::pair<size_type, size_type> locate(const void* item) const
+    {
+        const size_type block = mBlockMap.find(item);
+        const unsigned char* slot = static_cast<const unsigned char*>(item);
+        return std::make_pair(block, size_type(slot - mBlocks[block].data) / mStride);
+    }
+
+    /** Call run(block, first, last) for every run [first, last) of
+        live slots, from slot firstSlot of block firstBlock up to slot
+        lastSlot of block lastBlock.
+     */
+    template <typename Run>
+    void forEachRunIn(size_type firstBlock, size_type firstSlot,
+                      size_type lastBlock, size_type lastSlot, Run&& run) const
+    {
+        for (size_type block = firstBlock; block <= lastBlock and block < mBlocks.size(); block++)
+        {
+            const PolyPoolBitmap& live = mBlocks[block].live;
+            const size_type from = block == firstBlock ? firstSlot : 0;
+            const size_type to = block == lastBlock ? lastSlot : live.size();
+            for (size_type first = live.findNext(from); first < to;)
+            {
+                const size_type last = std::min(live.findNextUnset(first), to);
+                run(block, first, last);
+                first = live.findNext(last);
+            }
+        }
+    }
+
+    /** Split the used slots into ranges of about parallelGrain slots,
+        calling split(firstBlock, firstSlot, lastBlock, lastSlot) for
+        each. See forEachRunIn().
+     */
+    template <typename Split>
+    void splitSlots(Split&& split) const
+    {
+        size_type firstBlock = 0;
+        size_type firstSlot = 0;
+        size_type count = 0;
+        for (size_type block = 0; block < mBlocks.size(); block++)
+        {
+            const size_type used = mBlocks[block].size;
+            size_type slot = 0;
+            while (used - slot > parallelGrain - count)
+            {
+                slot += parallelGrain - count;
+                split(firstBlock, firstSlot, block, slot);
+                firstBlock = block;
+                firstSlot = slot;
+                count = 0;
+            }
+            count += used - slot;
+        }
+        if (count > 0) split(firstBlock, firstSlot, mBlocks.size(), 0);
+    }
+
+    /** Take a slot for a new item, preferring free slots.
+        The slot is not marked live until an item is constructed in
+        it, see commitSlot().
+     */
+    std::pair<size_type, size_type> allocateSlot()
+    {
+        std::pair<size_type, size_type> position;
+        if (popFree(position))
+        {
+            ++mReuses;
+        }
+        else
+        {
+            Block& block = getBlockForNewItem();
+            ++mSize;
+            position = std::make_pair(mLastBlock, block.size++);
+        }
+        mCurrentBlock = position.first;
+        return position;
+    }
+    void commitSlot(std::pair<size_type, size_type> position)
+    {
+        mBlocks[position.first].live.set(position.second);
+        ++mAllocations;
+    }
+
+    /** Make sure there are at least count never-used slots from the
+        block being filled onwards, creating blocks as needed.
+     */
+    void reserveSpare(size_type count)
+    {
+        size_type spare = 0;
+        for (size_type block = mLastBlock; block < mBlocks.size(); block++)
+        {
+            spare += mBlocks[block].capacity() - mBlocks[block].size;
+        }
+        while (spare < count)
+        {
+            allocateBlock();
+            spare += mBlocks.back().capacity();
+        }
+    }
+
+    /// Mark a slot free and link it into the free list.
+    void releaseSlot(void* item)
+    {
+        const auto position = locate(item);
+        mBlocks[position.first].live.reset(position.second);
+        releaseHandle(position.first, position.second);
+        pushFree(position.first, position.second);
+    }
+
+    /** Keep a released item constructed in its slot for popWarm().
+        The slot stops being live, so iteration skips it.
+     */
+    void pushWarm(void* item)
+    {
+        const auto position = locate(item);
+        mBlocks[position.first].live.reset(position.second);
+        releaseHandle(position.first, position.second);
+        mWarm.push_back(item);
+    }
+    /// Make the most recently released item live again, or nullptr.
+    void* popWarm()
+    {
+        if (mWarm.empty()) return nullptr;
+        void* item = mWarm.back();
+        mWarm.pop_back();
+        const auto position = locate(item);
+        mBlocks[position.first].live.set(position.second);
+        return item;
+    }
+    /** Destruct the released items and free their slots, before
+        anything that moves items or frees blocks.
+     */
+    void discardWarm()
+    {
+        for (void* item : mWarm)
+        {
+            destructItem(reinterpret_cast<Root*>(static_cast<unsigned char*>(item) + mRootOffset));
+            const auto position = locate(item);
+            pushFree(position.first, position.second);
+        }
+        mWarm.clear();
+    }
+
+    /// Add a slot to the free slots of the reuse policy.
+    void pushFree(size_type block, size_type slot)
+    {
+        if (mReuse == PolyPoolReuse::lifo)
+        {
+            mFreeItems.push(this->slot(block, slot));
+            return;
+        }
+        Block& current = mBlocks[block];
+        if (current.holes.empty())
+        {
+            current.holes = PolyPoolBitmap(current.capacity(), mResource);
+        }
+        current.holes.set(slot);
+        ++current.holeCount;
+        mHoleBlocks.set(block);
+        ++mHoles;
+    }
+    /// Take the free slot the reuse policy picks. False if none.
+    bool popFree(std::pair<size_type, size_type>& position)
+    {
+        if (mReuse == PolyPoolReuse::lifo)
+        {
+            void* slot = mFreeItems.pop();
+            if (not slot) return false;
+            position = locate(slot);
+            return true;
+        }
+        if (mHoles == 0) return false;
+
+        size_type block = mCurrentBlock;
+        if (mReuse != PolyPoolReuse::currentBlock
+            or block >= mBlocks.size() or mBlocks[block].holeCount == 0)
+        {
+            block = mHoleBlocks.findNext(0);
+        }
+        Block& current = mBlocks[block];
+        const size_type slot = current.holes.findNext(0);
+        current.holes.reset(slot);
+        if (--current.holeCount == 0) mHoleBlocks.reset(block);
+        --mHoles;
+        position = std::make_pair(block, slot);
+        return true;
+    }
+
+    /// Handle table index for the item in a slot, issuing one if needed.
+    handle_index acquireHandle(size_type block, size_type slot)
+    {
+        PolyPoolVector<handle_index>& handles = mBlocks[block].handles;
+        if (handles.empty())
+        {
+            handles.assign(mBlocks[block].capacity(), noHandle);
+        }
+        if (handles[slot] == noHandle)
+        {
+            if (mFreeHandles.empty())
+            {
+                mHandles.push_back(HandleEntry{nullptr, 0});
+                handles[slot] = handle_index(mHandles.size() - 1);
+            }
+            else
+            {
+                handles[slot] = mFreeHandles.back();
+                mFreeHandles.pop_back();
+            }
+            mHandles[handles[slot]].item = this->slot(block, slot);
+        }
+        return handles[slot];
+    }
+    /// Make all handles to the item in a slot stale.
+    void releaseHandle(size_type block, size_type slot)
+    {
+        PolyPoolVector<handle_index>& handles = mBlocks[block].handles;
+        if (handles.empty() or handles[slot] == noHandle) return;
+
+        HandleEntry& entry = mHandles[handles[slot]];
+        entry.item = nullptr;
+        ++entry.generation;
+        mFreeHandles.push_back(handles[slot]);
+        handles[slot] = noHandle;
+    }
+    /// Point the handle of a moved item at its new slot.
+    void moveHandle(size_type fromBlock, size_type fromSlot,
+                    size_type toBlock, size_type toSlot)
+    {
+        PolyPoolVector<handle_index>& from = mBlocks[fromBlock].handles;
+        if (from.empty() or from[fromSlot] == noHandle) return;
+
+        PolyPoolVector<handle_index>& to = mBlocks[toBlock].handles;
+        if (to.empty())
+        {
+            to.assign(mBlocks[toBlock].capacity(), noHandle);
+        }
+        to[toSlot] = from[fromSlot];
+        from[fromSlot] = noHandle;
+        mHandles[to[toSlot]].item = this->slot(toBlock, toSlot);
+    }
+    /// The slot a handle refers to, or nullptr if the handle is stale.
+    void* resolveHandle(handle_index index, handle_index generation) const
+    {
+        if (index >= mHandles.size()) return nullptr;
+        const HandleEntry& entry = mHandles[index];
+        return entry.generation == generation ? entry.item : nullptr;
+    }
+
+    /// Seek the first free slot at or after a position. False if none.
+    bool seekFreeSlot(size_type& block, size_type& slot) const
+    {
+        for (; block < mBlocks.size(); ++block, slot = 0)
+        {
+            slot = mBlocks[block].live.findNextUnset(slot);
+            if (slot < mBlocks[block].capacity()) return true;
+        }
+        return false;
+    }
+    /// Seek the last live item before a position. False if none.
+    bool seekLastLive(size_type& block, size_type& slot) const
+    {
+        while (true)
+        {
+            slot = mBlocks[block].live.findPrev(slot);
+            if (slot < mBlocks[block].capacity()) return true;
+            if (block == 0) return false;
+            --block;
+            slot = mBlocks[block].capacity();
+        }
+    }
+
+    /** Rebuild slot counts and the free list from the live bitmaps.
+        The block holding the last live item becomes the block being
+        filled. Slots past that item become spare again.
+     */
+    void rebuildFreeList()
+    {
+        mFreeItems.clear();
+        mHoleBlocks = PolyPoolBitmap(mBlocks.size(), mResource);
+        mHoles = 0;
+        for (auto& block : mBlocks)
+        {
+            block.holes = PolyPoolBitmap(0, mResource);
+            block.holeCount = 0;
+        }
+        mLastBlock = 0;
+        for (size_type block = 0; block < mBlocks.size(); block++)
+        {
+            if (mBlocks[block].live.findNext(0) < mBlocks[block].capacity())
+            {
+                mLastBlock = block;
+            }
+        }
+        mSize = 0;
+        for (size_type block = 0; block < mBlocks.size(); block++)
+        {
+            Block& current = mBlocks[block];
+            if (block < mLastBlock)
+            {
+                current.size = current.capacity();
+            }
+            else if (block == mLastBlock)
+            {
+                const size_type last = current.live.findPrev(current.capacity());
+                current.size = last < current.capacity() ? last + 1 : 0;
+            }
+            else
+            {
+                current.size = 0;
+            }
+            mSize += current.size;
+        }
+        // Push from the back so that the lowest slots are reused first.
+        for (size_type block = std::min(mLastBlock + 1, mBlocks.size()); block-- > 0;)
+        {
+            const Block& current = mBlocks[block];
+            for (size_type slot = current.size; slot-- > 0;)
+            {
+                if (not current.live.test(slot))
+                {
+                    pushFree(block, slot);
+                }
+            }
+        }
+    }
+
+    /** Write the segment's layout and blocks to a snapshot, see
+        PolyPoolSnapshotFormat. image(block) writes the first size
+        slots of a block; the rest are written as zeros.
+     */
+    template <typename Image>
+    void saveBlocks(PolyPoolSnapshotWriter& out, Image&& image) const
+    {
+        out.writeValue(mStride);
+        out.writeValue(mAlignment);
+        out.writeValue(mBlocks.size());
+        for (size_type block = 0; block < mBlocks.size(); block++)
+        {
+            const Block& current = mBlocks[block];
+            out.writeValue(current.capacity());
+            out.writeValue(current.size);
+            out.write(current.live.data(), PolyPoolSnapshotFormat::bitmapBytes(current.capacity()));
+            out.align(PolyPoolSnapshotFormat::imageAlignment(mAlignment));
+            image(block);
+            out.writeZeros((current.capacity() - current.size) * mStride);
+        }
+    }
+    /** Read blocks written by saveBlocks() into a segment holding no
+        blocks. With adopt set, blocks use their image in the snapshot
+        as storage where it is aligned well enough. fill(block, image,
+        live) then makes the items in the block live, given the block's
+        image and live bitmap words in the snapshot.
+     */
+    template <typename Fill>
+    void loadBlocks(const std::shared_ptr<PolyPoolSnapshotFile>& in, bool adopt, Fill&& fill)
+    {
+        if (not mBlocks.empty())
+        {
+            throw std::logic_error("Cannot load a snapshot into a segment holding blocks.");
+        }
+        PolyPoolSnapshotFile& file = *in;
+        if (file.readValue() != mStride or file.readValue() != mAlignment)
+        {
+            throw std::runtime_error("Snapshot layout does not match the type: " + file.path());
+        }
+        const size_type blocks = size_type(file.readValue());
+        try
+        {
+            for (size_type loaded = 0; loaded < blocks; loaded++)
+            {
+                const size_type capacity = size_type(file.readValue());
+                const size_type size = size_type(file.readValue());
+                if (capacity == 0 or size > capacity)
+                {
+                    throw std::runtime_error("Snapshot file is corrupt: " + file.path());
+                }
+                const unsigned char* live = file.take(PolyPoolSnapshotFormat::bitmapBytes(capacity));
+                file.align(PolyPoolSnapshotFormat::imageAlignment(mAlignment));
+                unsigned char* image = file.take(capacity * mStride);
+
+                const bool adopted = adopt and reinterpret_cast<std::uintptr_t>(image) % mAlignment == 0;
+                appendBlock(capacity, adopted ? image : nullptr);
+                if (adopted) mSnapshot = in;
+                mBlocks.back().size = size;
+                fill(mBlocks.size() - 1, image, live);
+            }
+        }
+        catch (...)
+        {
+            rebuildFreeList();
+            throw;
+        }
+        rebuildFreeList();
+    }
+    /// Copy live bits of the used slots of a block from a snapshot.
+    void loadLive(size_type block, const unsigned char* live)
+    {
+        Block& current = mBlocks[block];
+        const size_type words = (current.size + PolyPoolBitmap::word_bits - 1) / PolyPoolBitmap::word_bits;
+        std::memcpy(current.live.data(), live, words * sizeof(PolyPoolBitmap::word_type));
+        // Slots past size are spare, whatever the snapshot says.
+        if (current.size % PolyPoolBitmap::word_bits)
+        {
+            current.live.data()[words - 1] &=
+                (PolyPoolBitmap::word_type(1) << current.size % PolyPoolBitmap::word_bits) - 1;
+        }
+    }
+
+    /** Get a block with room for a new item.
+        May create a block if all current blocks are occupied.
+     */
+    Block& getBlockForNewItem()
+    {
+        if (mBlocks.empty())
+        {
+            allocateBlock();
+        }
+        else if (mBlocks[mLastBlock].size == mBlocks[mLastBlock].capacity())
+        {
+            if (mLastBlock == mBlocks.size() - 1)
+            {
+                // Create new block.
+                allocateBlock();
+            }
+            // Move to next block.
+            mLastBlock++;
+        }
+        return mBlocks[mLastBlock];
+    }
+
+    void allocateBlock()
+    {
+        appendBlock(blockSize(), nullptr);
+    }
+    /** Add a block, allocating its storage unless data is given, in
+        which case the block is adopted and never deallocated.
+     */
+    void appendBlock(size_type capacity, unsigned char* data)
+    {
+        Block block{
+            data ? data : static_cast<unsigned char*>(mBlockResource->allocate(capacity * mStride, mAlignment)),
+            0,
+            PolyPoolBitmap(capacity, mResource),
+            PolyPoolBitmap(0, mResource),
+            0,
+            PolyPoolVector<handle_index>(mResource),
+            data != nullptr};
+        mBlocks.push_back(std::move(block));
+        mHoleBlocks.push_back(false);
+        mBlockMap.push_back(mBlocks.back().data, capacity * mStride);
+        mCapacity += capacity;
+        ++mBlocksCreated;
+    }
+
+    void deallocateBlocks()
+    {
+        for (auto& block : mBlocks)
+        {
+            deallocateBlock(block);
+        }
+    }
+
+    void deallocateBlock(const Block& block)
+    {
+        if (block.adopted) return;
+        mBlockResource->deallocate(block.data, block.capacity() * mStride, mAlignment);
+    }
 };
+template <typename Root>
+const typename PolyPoolSegmentBase<Root>::handle_index PolyPoolSegmentBase<Root>::noHandle;
+template <typename Root>
+const typename PolyPoolSegmentBase<Root>::size_type PolyPoolSegmentBase<Root>::parallelGrain;
 
-template <typename T>
-struct PolyPoolVectorSegment : public PolyPoolSegment
+
+/** Storage for the items of type Child, stored as children of Root.
+
+    Final, so that calls made on a known segment type are resolved
+    statically.
+ */
+template <typename Child, typename Root>
+class PolyPoolSegment final : public PolyPoolSegmentBase<Root>
 {
-    std::vector<T> buffer;
+    template <typename, typename>
+    friend class PolyPoolLocalIterator;
+
+    using base=PolyPoolSegmentBase<Root>;
+    using handle_index=typename base::handle_index;
+    using layout=PolyPoolLayout<Child>;
+
+    static_assert(layout::stride() >= sizeof(Child) and layout::stride() % alignof(Child) == 0,
+                  "Layout stride must fit and align the type.");
+    static_assert(layout::stride() >= sizeof(void*),
+                  "Layout stride must fit the free-list link of a free slot.");
+    static_assert(layout::alignment() % alignof(Child) == 0,
+                  "Layout alignment must be a multiple of the type's alignment.");
+    static_assert(PolyPoolFixedRootOffset<Root, Child>::value,
+                  "Types must derive from the root without virtual inheritance.");
+
+public:
+    using size_type=std::size_t;
+    using iterator=PolyPoolLocalIterator<Child, Root>;
+
+    explicit PolyPoolSegment(PolyPoolGrowth growth,
+                             PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : base(std::move(growth), layout::stride(), layout::alignment(), rootOffset(), resource)
+    {
+    }
+
+    PolyPoolSegment(PolyPoolSegment&&) = default;
+
+    ~PolyPoolSegment()
+    {
+        // The blocks are released right after, so items are only
+        // destructed, and their slots are not freed.
+        for (void* warm : this->mWarm)
+        {
+            static_cast<Child*>(warm)->~Child();
+        }
+        for (size_type block = 0; block < this->mBlocks.size(); block++)
+        {
+            const PolyPoolBitmap& live = this->mBlocks[block].live;
+            for (size_type slot = live.findNext(0); slot < live.size();
+                 slot = live.findNext(slot + 1))
+            {
+                item(block, slot)->~Child();
+            }
+        }
+    }
+
+    template <typename... Args>
+    Child* emplace(Args&&... args)
+    {
+        const auto position = this->allocateSlot();
+        void* slot = this->slot(position.first, position.second);
+        Child* item;
+        try
+        {
+            item = new (slot) Child(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            this->pushFree(position.first, position.second);
+            throw;
+        }
+        this->commitSlot(position);
+        return item;
+    }
+
+    /** Construct count items from the same arguments.
+
+        Free slots are reused first. The remaining items are built in
+        runs of fresh slots, block by block, after allocating all the
+        blocks they need at once.
+     */
+    template <typename... Args>
+    PolyPoolVector<Child*> emplace_n(size_type count, const Args&... args)
+    {
+        PolyPoolVector<Child*> items(this->mResource);
+        items.reserve(count);
+        while (items.size() < count and this->holes() > 0)
+        {
+            items.push_back(emplace(args...));
+        }
+        fill(count - items.size(), items,
+             [&](void* slot) { return new (slot) Child(args...); });
+        return items;
+    }
+
+    /** Construct an item from each element of [first, last).
+        See emplace_n() for notes.
+     */
+    template <typename InputIt>
+    PolyPoolVector<Child*> insert_range(InputIt first, InputIt last)
+    {
+        PolyPoolVector<Child*> items(this->mResource);
+        insert_range(first, last, items,
+                     typename std::iterator_traits<InputIt>::iterator_category());
+        return items;
+    }
+
+    /// Add item to free list without calling its destructor.
+    void free(Child* item)
+    {
+        this->releaseSlot(item);
+    }
+    /// Call item destructor and add it to free list.
+    void destroy(Child* item)
+    {
+        item->~Child();
+        this->releaseSlot(item);
+    }
+
+    /** Keep an item constructed for acquire() instead of destroying
+        it, after calling its reset() member if it has one.
+     */
+    void release(Child* item)
+    {
+        resetItem(item, 0);
+        this->pushWarm(item);
+    }
+    /// The most recently released item, or a new one built from args.
+    template <typename... Args>
+    Child* acquire(Args&&... args)
+    {
+        void* warm = this->popWarm();
+        if (warm) return static_cast<Child*>(warm);
+        return emplace(std::forward<Args>(args)...);
+    }
+    /// Construct count items from the same arguments, ready for acquire().
+    template <typename... Args>
+    void prewarm(size_type count, const Args&... args)
+    {
+        for (Child* item : emplace_n(count, args...))
+        {
+            this->pushWarm(item);
+        }
+    }
+
+    /** Get a handle to a live item.
+        Repeated calls for the same item return equal handles.
+        Throws std::invalid_argument if item is not a live item of
+        this segment: destroyed, freed and released items have none.
+     */
+    PolyPoolHandle<Child> handle(Child* item)
+    {
+        const size_type block = this->mBlockMap.find(item);
+        if (block == PolyPoolBlockMap::none)
+        {
+            throw std::invalid_argument("Object is not stored by this PolyPool as its own type.");
+        }
+        const size_type offset = size_type(reinterpret_cast<unsigned char*>(item) - this->mBlocks[block].data);
+        const std::pair<size_type, size_type> position(block, offset / this->mStride);
+        if (offset % this->mStride != 0 or not this->mBlocks[block].live.test(position.second))
+        {
+            throw std::invalid_argument("Cannot get a handle to an object that is not live.");
+        }
+        const handle_index index = this->acquireHandle(position.first, position.second);
+        return PolyPoolHandle<Child>(index, this->mHandles[index].generation);
+    }
+    /// The item a handle refers to, or nullptr if it is gone.
+    Child* resolve(PolyPoolHandle<Child> handle) const
+    {
+        return static_cast<Child*>(this->resolveHandle(handle.mIndex, handle.mGeneration));
+    }
+
+    /** Destroy every live item for which pred(item) is true.
+
+        Items are tested and destructed in storage order, in one sweep
+        per block, without looking up their blocks.
+
+        Returns the number of items destroyed.
+     */
+    template <typename Predicate>
+    size_type destroy_if(Predicate&& pred)
+    {
+        size_type destroyed = 0;
+        for (size_type block = 0; block < this->mBlocks.size(); block++)
+        {
+            PolyPoolBitmap& live = this->mBlocks[block].live;
+            for (size_type slot = live.findNext(0); slot < live.size();
+                 slot = live.findNext(slot + 1))
+            {
+                Child* candidate = item(block, slot);
+                if (pred(*candidate))
+                {
+                    candidate->~Child();
+                    live.reset(slot);
+                    this->releaseHandle(block, slot);
+                    this->pushFree(block, slot);
+                    ++destroyed;
+                }
+            }
+        }
+        return destroyed;
+    }
+
+    /** Destroy a range of items.
+        Items are sorted and destructed in address order, so each
+        block is looked up once rather than once per item.
+     */
+    template <typename ForwardIt>
+    void destroy(ForwardIt first, ForwardIt last)
+    {
+        PolyPoolVector<Child*> items(first, last, this->mResource);
+        std::sort(items.begin(), items.end(), std::less<Child*>());
+        destroySorted(items.begin(), items.end());
+    }
+
+    void destroyItem(Root* item) override
+    {
+        destroy(static_cast<Child*>(item));
+    }
+    void freeItem(Root* item) override
+    {
+        free(static_cast<Child*>(item));
+    }
+    void releaseItem(Root* item) override
+    {
+        release(static_cast<Child*>(item));
+    }
+    size_type destroyItemsIf(const std::function<bool(Root&)>& pred) override
+    {
+        return destroy_if(pred);
+    }
+    void destroyItems(Root* const* first, Root* const* last) override
+    {
+        destroySorted(first, last);
+    }
+    void* destructItem(Root* item) override
+    {
+        Child* destructed = static_cast<Child*>(item);
+        destructed->~Child();
+        return destructed;
+    }
+    void saveItems(PolyPoolSnapshotWriter& out) const override
+    {
+        saveItems(out, typename PolyPoolSnapshotTraits<Child>::method());
+    }
+    void loadItems(const std::shared_ptr<PolyPoolSnapshotFile>& in) override
+    {
+        loadItems(in, typename PolyPoolSnapshotTraits<Child>::method());
+    }
+
+    void freeAll() override
+    {
+        this->discardWarm();
+        for (size_type block = 0; block < this->mBlocks.size(); block++)
+        {
+            PolyPoolBitmap& live = this->mBlocks[block].live;
+            for (size_type slot = live.findNext(0); slot < live.size();
+                 slot = live.findNext(slot + 1))
+            {
+                Child* freeItem = item(block, slot);
+                freeItem->~Child();
+                live.reset(slot);
+                this->releaseHandle(block, slot);
+                this->pushFree(block, slot);
+            }
+        }
+    }
+
+    /** Move live items into the lowest free slots, packing them to
+        the front of the segment. Free slots become spare capacity.
+
+        relocate(old, new) is called for every item moved, once it has
+        been move constructed at its new address and before the old
+        item is destructed. If relocate or the move constructor throws,
+        the item stays at its old address, as left by its move
+        constructor, and items already moved stay moved.
+     */
+    template <typename F>
+    void defragment(F&& relocate)
+    {
+        static_assert(std::is_move_constructible<Child>::value,
+                      "Defragmenting requires move constructible items.");
+        this->discardWarm();
+        if (this->mBlocks.empty()) return;
+
+        size_type toBlock = 0;
+        size_type toSlot = 0;
+        size_type fromBlock = this->mBlocks.size() - 1;
+        size_type fromSlot = this->mBlocks[fromBlock].capacity();
+        try
+        {
+            while (this->seekFreeSlot(toBlock, toSlot)
+                   and this->seekLastLive(fromBlock, fromSlot)
+                   and (fromBlock > toBlock or (fromBlock == toBlock and fromSlot > toSlot)))
+            {
+                Child* from = item(fromBlock, fromSlot);
+                Child* to = new (this->slot(toBlock, toSlot)) Child(std::move(*from));
+                try
+                {
+                    relocate(from, to);
+                }
+                catch (...)
+                {
+                    to->~Child();
+                    throw;
+                }
+                this->mBlocks[toBlock].live.set(toSlot);
+                from->~Child();
+                this->mBlocks[fromBlock].live.reset(fromSlot);
+                this->moveHandle(fromBlock, fromSlot, toBlock, toSlot);
+            }
+        }
+        catch (...)
+        {
+            this->rebuildFreeList();
+            throw;
+        }
+        this->rebuildFreeList();
+    }
+    void defragment()
+    {
+        defragment([](Child*, Child*) {});
+    }
+
+    void defragmentItems(const std::function<void(Root*, Root*)>& relocate) override
+    {
+        defragmentItems(relocate, std::is_move_constructible<Child>());
+    }
+
+    /** Call f on every live item, in storage order.
+
+        f is called with Child&, so calls on items can be inlined.
+        Items are visited in runs of consecutive live slots, each a
+        plain loop with the layout's constant stride.
+     */
+    template <typename F>
+    void for_each(F&& f)
+    {
+        this->mHolesSkipped += this->holes();
+        for (size_type block = 0; block < this->mBlocks.size(); block++)
+        {
+            const PolyPoolBitmap& live = this->mBlocks[block].live;
+            for (size_type first = live.findNext(0); first < live.size();)
+            {
+                const size_type last = live.findNextUnset(first);
+                for (size_type slot = first; slot < last; slot++)
+                {
+                    f(*item(block, slot));
+                }
+                first = live.findNext(last);
+            }
+        }
+    }
+
+    /** Add tasks calling f on every live item to a batch.
+        See PolyPoolSegmentBase::parallelRootTasks().
+     */
+    template <typename F>
+    void parallelTasks(F& f, PolyPoolExecutor::task_list& tasks)
+    {
+        this->mHolesSkipped += this->holes();
+        this->splitSlots([this, &f, &tasks](size_type firstBlock, size_type firstSlot,
+                                            size_type lastBlock, size_type lastSlot)
+        {
+            tasks.push_back([this, &f, firstBlock, firstSlot, lastBlock, lastSlot]
+            {
+                this->forEachRunIn(firstBlock, firstSlot, lastBlock, lastSlot,
+                                   [&](size_type block, size_type first, size_type last)
+                {
+                    for (size_type slot = first; slot < last; slot++)
+                    {
+                        f(*this->item(block, slot));
+                    }
+                });
+            });
+        });
+    }
+
+    iterator begin()
+    {
+        iterator iter(this, 0, 0);
+        iter.seekActive();
+        return iter;
+    }
+    iterator end()
+    {
+        return iterator(this, this->mBlocks.size(), 0);
+    }
+
+    /** The items of a block as a contiguous array, see
+        PolyPool::segments(). Only layouts that pack items tightly
+        give arrays of Child, so types smaller than a pointer, whose
+        slots are padded, have no spans.
+     */
+    PolyPoolBlockSpan<Child> blockSpan(size_type block)
+    {
+        static_assert(layout::stride() == sizeof(Child),
+                      "Block spans require a layout without padding between items.");
+        return PolyPoolBlockSpan<Child>(item(block, 0), this->mBlocks[block].size,
+                                        this->mBlocks[block].live);
+    }
+
+protected:
+    /// Destroy items given in ascending address order.
+    template <typename It>
+    void destroySorted(It first, It last)
+    {
+        const unsigned char* blockBegin = nullptr;
+        const unsigned char* blockEnd = nullptr;
+        size_type block = 0;
+        for (; first != last; ++first)
+        {
+            Child* destroyed = static_cast<Child*>(*first);
+            const unsigned char* address = reinterpret_cast<const unsigned char*>(destroyed);
+            if (address < blockBegin or address >= blockEnd)
+            {
+                block = this->locate(destroyed).first;
+                blockBegin = this->mBlocks[block].data;
+                blockEnd = blockBegin + this->mBlocks[block].capacity() * this->mStride;
+            }
+            const size_type slot = size_type(address - blockBegin) / this->mStride;
+            destroyed->~Child();
+            this->mBlocks[block].live.reset(slot);
+            this->releaseHandle(block, slot);
+            this->pushFree(block, slot);
+        }
+    }
+
+    /** Construct count items in fresh slots, in storage order.
+        make(slot) constructs an item in slot and returns it.
+     */
+    template <typename Make>
+    void fill(size_type count, PolyPoolVector<Child*>& items, Make&& make)
+    {
+        if (count == 0) return;
+        this->reserveSpare(count);
+
+        for (size_type block = this->mLastBlock; count > 0; block++)
+        {
+            auto& current = this->mBlocks[block];
+            const size_type first = current.size;
+            const size_type last = std::min(current.capacity(), first + count);
+            size_type slot = first;
+            try
+            {
+                for (; slot < last; slot++)
+                {
+                    items.push_back(make(this->slot(block, slot)));
+                }
+            }
+            catch (...)
+            {
+                // Keep the items built so far.
+                current.live.set(first, slot);
+                current.size = slot;
+                this->mSize += slot - first;
+                this->mAllocations += slot - first;
+                this->mLastBlock = block;
+                throw;
+            }
+            current.live.set(first, last);
+            current.size = last;
+            this->mSize += last - first;
+            this->mAllocations += last - first;
+            this->mLastBlock = block;
+            count -= last - first;
+        }
+    }
+
+    template <typename InputIt>
+    void insert_range(InputIt first, InputIt last, PolyPoolVector<Child*>& items,
+                      std::input_iterator_tag)
+    {
+        for (; first != last; ++first)
+        {
+            items.push_back(emplace(*first));
+        }
+    }
+    template <typename ForwardIt>
+    void insert_range(ForwardIt first, ForwardIt last, PolyPoolVector<Child*>& items,
+                      std::forward_iterator_tag)
+    {
+        const size_type count = std::distance(first, last);
+        items.reserve(count);
+        for (; first != last and this->holes() > 0; ++first)
+        {
+            items.push_back(emplace(*first));
+        }
+        fill(count - items.size(), items,
+             [&](void* slot) { return new (slot) Child(*first++); });
+    }
+
+    void defragmentItems(const std::function<void(Root*, Root*)>& relocate, std::true_type)
+    {
+        if (relocate)
+        {
+            defragment([&relocate](Child* from, Child* to) { relocate(from, to); });
+        }
+        else
+        {
+            defragment();
+        }
+    }
+    void defragmentItems(const std::function<void(Root*, Root*)>&, std::false_type)
+    {
+    }
+
+    void saveItems(PolyPoolSnapshotWriter& out, PolyPoolSnapshotBitwise) const
+    {
+        this->saveBlocks(out, [this, &out](size_type block)
+        {
+            out.write(this->mBlocks[block].data, this->mBlocks[block].size * layout::stride());
+        });
+    }
+    void saveItems(PolyPoolSnapshotWriter& out, PolyPoolSnapshotHooked) const
+    {
+        PolyPoolVector<unsigned char> image(this->mResource);
+        this->saveBlocks(out, [this, &out, &image](size_type block)
+        {
+            const PolyPoolBitmap& live = this->mBlocks[block].live;
+            image.assign(this->mBlocks[block].size * layout::stride(), 0);
+            for (size_type slot = live.findNext(0); slot < live.size();
+                 slot = live.findNext(slot + 1))
+            {
+                PolyPoolSnapshot<Child>::save(*item(block, slot), image.data() + slot * layout::stride());
+            }
+            out.write(image.data(), image.size());
+        });
+    }
+    void saveItems(PolyPoolSnapshotWriter&, PolyPoolSnapshotUnsupported) const
+    {
+        throw std::logic_error("Type cannot be saved to a snapshot; see PolyPoolSnapshot.");
+    }
+
+    void loadItems(const std::shared_ptr<PolyPoolSnapshotFile>& in, PolyPoolSnapshotBitwise)
+    {
+        this->loadBlocks(in, true, [this](size_type block, const unsigned char* image,
+                                          const unsigned char* live)
+        {
+            if (this->mBlocks[block].data != image)
+            {
+                std::memcpy(this->mBlocks[block].data, image, this->mBlocks[block].size * layout::stride());
+            }
+            this->loadLive(block, live);
+        });
+    }
+    void loadItems(const std::shared_ptr<PolyPoolSnapshotFile>& in, PolyPoolSnapshotHooked)
+    {
+        this->loadBlocks(in, false, [this](size_type block, const unsigned char* image,
+                                           const unsigned char* live)
+        {
+            using word_type=PolyPoolBitmap::word_type;
+            const size_type size = this->mBlocks[block].size;
+            for (size_type first = 0; first < size; first += PolyPoolBitmap::word_bits)
+            {
+                word_type bits;
+                std::memcpy(&bits, live + first / 8, sizeof(bits));
+                for (; bits; bits &= bits - 1)
+                {
+                    const size_type slot = first + PolyPoolBitmap::countTrailingZeros(bits);
+                    if (slot >= size) break;
+                    PolyPoolSnapshot<Child>::load(image + slot * layout::stride(), item(block, slot));
+                    this->mBlocks[block].live.set(slot);
+                }
+            }
+        });
+    }
+    void loadItems(const std::shared_ptr<PolyPoolSnapshotFile>&, PolyPoolSnapshotUnsupported)
+    {
+        throw std::logic_error("Type cannot be loaded from a snapshot; see PolyPoolSnapshot.");
+    }
+
+    template <typename T>
+    static auto resetItem(T* item, int) -> decltype(item->reset(), void())
+    {
+        item->reset();
+    }
+    template <typename T>
+    static void resetItem(T*, long)
+    {
+    }
+
+    /// The item in a slot, using the stride known at compile time.
+    Child* item(size_type block, size_type slot) const
+    {
+        return reinterpret_cast<Child*>(this->mBlocks[block].data + slot * layout::stride());
+    }
+
+    static std::ptrdiff_t rootOffset()
+    {
+        // Converting a pointer to a non-virtual base only adds a
+        // constant, so it can be measured on storage that holds no
+        // object. Virtual bases are ruled out by the class's
+        // static_assert.
+        typename std::aligned_storage<sizeof(Child), alignof(Child)>::type probe;
+        Child* child = reinterpret_cast<Child*>(&probe);
+        return reinterpret_cast<unsigned char*>(static_cast<Root*>(child))
+            - reinterpret_cast<unsigned char*>(child);
+    }
 };
-#endif
@@ -0,0 +1,535 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "PolyPoolBitmap.h"
+#include "PolyPoolBlockMap.h"
+#include "PolyPoolFreeList.h"
+#include "PolyPoolLayout.h"
+#include "PolyPoolMemory.h"
+#include "PolyPoolType.h"
+
+/** Append-only list of pointers, readable while one writer appends.
+
+    Entries live in an array that is replaced by a larger copy when
+    full. The current array and the entry count are published
+    atomically, and replaced arrays are kept until destruction, so a
+    reader never sees an entry move or disappear.
+ */
+template <typename T>
+class PolyPoolDirectory
+{
+public:
+    using size_type=std::size_t;
+
+    explicit PolyPoolDirectory(PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : mArrays(resource)
+    {
+    }
+    PolyPoolDirectory(const PolyPoolDirectory&) = delete;
+    PolyPoolDirectory& operator=(const PolyPoolDirectory&) = delete;
+
+    /// Append an entry. Writer only.
+    void push_back(T* entry)
+    {
+        const size_type size = mSize.load(std::memory_order_relaxed);
+        if (size == mCapacity)
+        {
+            mCapacity = mCapacity ? 2 * mCapacity : 8;
+            PolyPoolVector<T*> entries(mCapacity, nullptr, mArrays.get_allocator().resource());
+            for (size_type index = 0; index < size; index++)
+            {
+                entries[index] = mArrays.back()[index];
+            }
+            // Moving a vector keeps its storage, so readers of older
+            // arrays are unaffected when mArrays grows.
+            mArrays.push_back(std::move(entries));
+            mEntries.store(mArrays.back().data(), std::memory_order_release);
+        }
+        mArrays.back()[size] = entry;
+        mSize.store(size + 1, std::memory_order_release);
+    }
+
+    /// Number of published entries.
+    size_type size() const
+    {
+        return mSize.load(std::memory_order_acquire);
+    }
+    /// Entry at an index below a size() read earlier.
+    T* operator[](size_type index) const
+    {
+        return mEntries.load(std::memory_order_acquire)[index];
+    }
+
+private:
+    std::atomic<T**> mEntries{nullptr};
+    std::atomic<size_type> mSize{0};
+    /// Writer only.
+    size_type mCapacity = 0;
+    PolyPoolVector<PolyPoolVector<T*> > mArrays;
+};
+
+
+/** Storage for the items of a single type, seen through their root
+    type, shared by one writer and many readers.
+
+    Like PolyPoolSegmentBase, but blocks are listed in a
+    PolyPoolDirectory and live slots are marked in atomic words. The
+    writer marks a slot live with a release store only once its item
+    is fully constructed, so readers scanning with acquire loads never
+    see a half-constructed item.
+ */
+template <typename Root>
+class PolyPoolSharedSegmentBase
+{
+public:
+    using size_type=std::size_t;
+    using word_type=PolyPoolBitmap::word_type;
+
+    static const size_type word_bits = PolyPoolBitmap::word_bits;
+
+    virtual ~PolyPoolSharedSegmentBase()
+    {
+        // Blocks may be owned without being published, if adding
+        // them failed midway.
+        for (const auto& block : mOwnedBlocks)
+        {
+            if (block->data)
+            {
+                mResource->deallocate(block->data, block->capacity * mStride, mAlignment);
+            }
+            if (block->live)
+            {
+                mResource->deallocate(block->live, words(block->capacity) * sizeof(std::atomic<word_type>),
+                                      alignof(std::atomic<word_type>));
+            }
+        }
+    }
+
+    /// Call item destructor and add it to free list. Writer only.
+    virtual void destroyItem(Root* item) = 0;
+
+    /// Type of the items. Immutable, so readers may call it.
+    const std::type_info& type() const
+    {
+        return mType;
+    }
+
+    /// Number of active items, as last published by the writer.
+    size_type active() const
+    {
+        return mActive.load(std::memory_order_relaxed);
+    }
+    /// Number of blocks, as last published by the writer.
+    size_type blocks() const
+    {
+        return mBlocks.size();
+    }
+
+    /// Call f on every live item as Root&. Safe for readers.
+    template <typename F>
+    void forEachRoot(F&& f) const
+    {
+        forEachSlot([&](unsigned char* slot)
+        {
+            f(*reinterpret_cast<Root*>(slot + mRootOffset));
+        });
+    }
+
+protected:
+    struct Block
+    {
+        unsigned char* data;
+        size_type capacity;
+        /// Slots handed out so far, active or free. Writer only.
+        size_type size;
+        /// words(capacity) live words.
+        std::atomic<word_type>* live;
+    };
+
+    /// Source of blocks and bookkeeping.
+    PolyPoolMemoryResource* mResource;
+    PolyPoolDirectory<Block> mBlocks;
+    /// Owns the blocks listed in mBlocks. Writer only.
+    PolyPoolVector<PolyPoolOwner<Block> > mOwnedBlocks;
+    std::atomic<size_type> mActive{0};
+    const std::type_info& mType;
+    const size_type mStride;
+    const size_type mAlignment;
+    const std::ptrdiff_t mRootOffset;
+
+    /// Writer only.
+    PolyPoolBlockMap mBlockMap;
+    PolyPoolFreeList mFreeItems;
+    size_type mBlockSize;
+
+    PolyPoolSharedSegmentBase(const std::type_info& type, size_type blockSize,
+                              size_type stride, size_type alignment, std::ptrdiff_t rootOffset,
+                              PolyPoolMemoryResource* resource)
+        : mResource(resource)
+        , mBlocks(resource)
+        , mOwnedBlocks(resource)
+        , mType(type)
+        , mStride(stride)
+        , mAlignment(alignment)
+        , mRootOffset(rootOffset)
+        , mBlockMap(resource)
+        , mBlockSize(blockSize)
+    {
+    }
+
+    /// Call visit(slot) for every live slot, scanning atomically.
+    template <typename Visit>
+    void forEachSlot(Visit&& visit) const
+    {
+        const size_type blocks = mBlocks.size();
+        for (size_type index = 0; index < blocks; index++)
+        {
+            const Block& block = *mBlocks[index];
+            const size_type count = words(block.capacity);
+            for (size_type word = 0; word < count; word++)
+            {
+                word_type bits = block.live[word].load(std::memory_order_acquire);
+                while (bits)
+                {
+                    const size_type slot = word * word_bits
+                        + PolyPoolBitmap::countTrailingZeros(bits);
+                    visit(block.data + slot * mStride);
+                    bits &= bits - 1;
+                }
+            }
+        }
+    }
+
+    /// Take a free or fresh slot for a new item. Writer only.
+    void* allocateSlot()
+    {
+        void* slot = mFreeItems.pop();
+        if (slot) return slot;
+
+        if (mBlocks.size() == 0 or lastBlock().size == lastBlock().capacity)
+        {
+            const size_type count = words(mBlockSize);
+            mOwnedBlocks.push_back(mResource->create<Block>());
+            Block* block = mOwnedBlocks.back().get();
+            block->capacity = mBlockSize;
+            block->data = static_cast<unsigned char*>(mResource->allocate(mBlockSize * mStride, mAlignment));
+            block->live = static_cast<std::atomic<word_type>*>(
+                mResource->allocate(count * sizeof(std::atomic<word_type>), alignof(std::atomic<word_type>)));
+            for (size_type word = 0; word < count; word++)
+            {
+                new (&block->live[word]) std::atomic<word_type>(0);
+            }
+            mBlockMap.push_back(block->data, mBlockSize * mStride);
+            // Publishing the block releases its cleared live words too.
+            mBlocks.push_back(block);
+        }
+        Block& block = lastBlock();
+        return block.data + block.size++ * mStride;
+    }
+
+    /// Mark the slot of a constructed item live, publishing it.
+    void publishSlot(void* slot)
+    {
+        updateLive(slot, true);
+        mActive.store(active() + 1, std::memory_order_relaxed);
+    }
+    /// Mark a slot free and link it into the free list. Writer only.
+    void releaseSlot(void* slot)
+    {
+        updateLive(slot, false);
+        mActive.store(active() - 1, std::memory_order_relaxed);
+        mFreeItems.push(slot);
+    }
+
+private:
+    static size_type words(size_type capacity)
+    {
+        return (capacity + word_bits - 1) / word_bits;
+    }
+
+    Block& lastBlock()
+    {
+        return *mBlocks[mBlocks.size() - 1];
+    }
+
+    void updateLive(void* item, bool live)
+    {
+        Block& block = *mBlocks[mBlockMap.find(item)];
+        const size_type slot = size_type(static_cast<unsigned char*>(item) - block.data) / mStride;
+        std::atomic<word_type>& word = block.live[slot / word_bits];
+        const word_type bit = word_type(1) << (slot % word_bits);
+        // Only the writer stores, so no read-modify-write is needed.
+        const word_type bits = word.load(std::memory_order_relaxed);
+        word.store(live ? bits | bit : bits & ~bit, std::memory_order_release);
+    }
+};
+
+template <typename Root>
+const typename PolyPoolSharedSegmentBase<Root>::size_type PolyPoolSharedSegmentBase<Root>::word_bits;
+
+
+/// Storage for the items of type Child, see PolyPoolSharedSegmentBase.
+template <typename Child, typename Root>
+class PolyPoolSharedSegment final : public PolyPoolSharedSegmentBase<Root>
+{
+    using base=PolyPoolSharedSegmentBase<Root>;
+    using layout=PolyPoolLayout<Child>;
+
+    static_assert(layout::stride() >= sizeof(Child) and layout::stride() >= sizeof(void*),
+                  "Layout stride must fit the type and the free-list link of a free slot.");
+    static_assert(PolyPoolFixedRootOffset<Root, Child>::value,
+                  "Types must derive from the root without virtual inheritance.");
+
+public:
+    using size_type=std::size_t;
+
+    PolyPoolSharedSegment(size_type blockSize, PolyPoolMemoryResource* resource)
+        : base(typeid(Child), blockSize, layout::stride(), layout::alignment(), rootOffset(), resource)
+    {
+    }
+
+    ~PolyPoolSharedSegment()
+    {
+        this->forEachSlot([](unsigned char* slot)
+        {
+            reinterpret_cast<Child*>(slot)->~Child();
+        });
+    }
+
+    /// Writer only.
+    template <typename... Args>
+    Child* emplace(Args&&... args)
+    {
+        void* slot = this->allocateSlot();
+        Child* item;
+        try
+        {
+            item = new (slot) Child(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            this->mFreeItems.push(slot);
+            throw;
+        }
+        this->publishSlot(slot);
+        return item;
+    }
+
+    /// Writer only.
+    void destroy(Child* item)
+    {
+        item->~Child();
+        this->releaseSlot(item);
+    }
+    void destroyItem(Root* item) override
+    {
+        destroy(static_cast<Child*>(item));
+    }
+
+    /// Call f on every live item as Child&. Safe for readers.
+    template <typename F>
+    void for_each(F&& f) const
+    {
+        this->forEachSlot([&](unsigned char* slot)
+        {
+            f(*reinterpret_cast<Child*>(slot));
+        });
+    }
+
+private:
+    static std::ptrdiff_t rootOffset()
+    {
+        // See PolyPoolSegment::rootOffset().
+        typename std::aligned_storage<sizeof(Child), alignof(Child)>::type probe;
+        Child* child = reinterpret_cast<Child*>(&probe);
+        return reinterpret_cast<unsigned char*>(static_cast<Root*>(child))
+            - reinterpret_cast<unsigned char*>(child);
+    }
+};
+
+
+/** Open-world polymorphic object pool shared by one writer thread and
+    any number of reader threads.
+
+    The writer adds objects with emplace() and insert() while readers
+    visit objects with for_each(). Readers never block: segments and
+    their blocks are listed in append-only directories, so nothing a
+    reader holds is ever moved or freed by the writer, and objects
+    only become visible to readers once fully constructed.
+
+    A reader sees every object added before its visit started, and
+    possibly some added during it.
+
+    destroy() must only be called while no reader is visiting
+    objects, since a reader may be using the object.
+ */
+template <typename Root>
+class PolyPoolShared
+{
+public:
+    using size_type=std::size_t;
+
+    PolyPoolShared()
+        : PolyPoolShared(PolyPoolMemoryResource::defaultResource())
+    {
+    }
+
+    /** Pool drawing all its memory, for objects and bookkeeping alike,
+        from a resource, which must outlive the pool.
+     */
+    explicit PolyPoolShared(PolyPoolMemoryResource* resource)
+        : mSegments(resource)
+        , mOwnedSegments(resource)
+        , mSegmentIndex(0, std::hash<std::type_index>(), std::equal_to<std::type_index>(), resource)
+        , mResource(resource)
+    {
+    }
+
+    explicit PolyPoolShared(size_type defaultBlockSize,
+                            PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : PolyPoolShared(resource)
+    {
+        setDefaultBlockSize(defaultBlockSize);
+    }
+    /** Same, for literal block sizes: without it, PolyPoolShared(0) would be
+        ambiguous with the resource constructor. Negative sizes are
+        taken as zero.
+     */
+    explicit PolyPoolShared(int defaultBlockSize,
+                            PolyPoolMemoryResource* resource = PolyPoolMemoryResource::defaultResource())
+        : PolyPoolShared(size_type(defaultBlockSize > 0 ? defaultBlockSize : 0), resource)
+    {
+    }
+
+    PolyPoolShared(const PolyPoolShared&) = delete;
+    PolyPoolShared& operator=(const PolyPoolShared&) = delete;
+
+    /// Writer only.
+    template <typename Child>
+    typename std::decay<Child>::type* insert(Child&& child)
+    {
+        using Type=typename std::decay<Child>::type;
+        return segment<Type>().emplace(std::forward<Child>(child));
+    }
+
+    /// Writer only.
+    template <typename Child, typename... Args>
+    Child* emplace(Args&&... args)
+    {
+        return segment<Child>().emplace(std::forward<Args>(args)...);
+    }
+
+    /** Call object destructor and add it to free object list.
+        Writer only, and only while no reader is visiting objects.
+        Objects are found as by PolyPool::destroy().
+     */
+    template <typename Child>
+    void destroy(Child* item)
+    {
+        mSegmentIndex.at(PolyPoolFiledType<Child>::of(item))->destroyItem(item);
+    }
+
+    /** Set the block size of newly created segments. A size of zero
+        is taken as one. Writer only.
+     */
+    void setDefaultBlockSize(size_type size)
+    {
+        mDefaultBlockSize = size > 0 ? size : 1;
+    }
+
+    /// Number of active items, as last published by the writer.
+    size_type active() const
+    {
+        size_type size = 0;
+        const size_type segments = mSegments.size();
+        for (size_type segment = 0; segment < segments; segment++)
+        {
+            size += mSegments[segment]->active();
+        }
+        return size;
+    }
+
+    /// Call f on every active object, with Root&. Safe for readers.
+    template <typename F>
+    void for_each(F&& f) const
+    {
+        const size_type segments = mSegments.size();
+        for (size_type segment = 0; segment < segments; segment++)
+        {
+            mSegments[segment]->forEachRoot(f);
+        }
+    }
+    /** Call f on every active object. Safe for readers.
+        Like PolyPool<Root>::for_each<Child, ...>(), objects of the
+        listed types are passed by static type, and others as Root&.
+     */
+    template <typename Child, typename... Listed, typename F>
+    void for_each(F&& f) const
+    {
+        const size_type segments = mSegments.size();
+        for (size_type segment = 0; segment < segments; segment++)
+        {
+            if (not forEachListed<Child, Listed...>(*mSegments[segment], f))
+            {
+                mSegments[segment]->forEachRoot(f);
+            }
+        }
+    }
+
+protected:
+    /// Published to readers.
+    PolyPoolDirectory<PolyPoolSharedSegmentBase<Root> > mSegments;
+    /// Writer only.
+    PolyPoolVector<PolyPoolOwner<PolyPoolSharedSegmentBase<Root> > > mOwnedSegments;
+    std::unordered_map<std::type_index, PolyPoolSharedSegmentBase<Root>*,
+                       std::hash<std::type_index>, std::equal_to<std::type_index>,
+                       PolyPoolAllocator<std::pair<const std::type_index, PolyPoolSharedSegmentBase<Root>*> > >
+        mSegmentIndex;
+    PolyPoolMemoryResource* mResource;
+    size_type mDefaultBlockSize = 20;
+
+    template <typename Child>
+    PolyPoolSharedSegment<Child, Root>& segment()
+    {
+        auto& segment = mSegmentIndex[typeid(Child)];
+        if (not segment)
+        {
+            mOwnedSegments.push_back(
+                mResource->create<PolyPoolSharedSegmentBase<Root>, PolyPoolSharedSegment<Child, Root> >(
+                    mDefaultBlockSize, mResource));
+            segment = mOwnedSegments.back().get();
+            mSegments.push_back(segment);
+        }
+        return static_cast<PolyPoolSharedSegment<Child, Root>&>(*segment);
+    }
+
+    template <typename F>
+    static bool forEachListed(const PolyPoolSharedSegmentBase<Root>&, F&)
+    {
+        return false;
+    }
+    template <typename Child, typename... Listed, typename F>
+    static bool forEachListed(const PolyPoolSharedSegmentBase<Root>& segment, F& f)
+    {
+        if (segment.type() == typeid(Child))
+        {
+            static_cast<const PolyPoolSharedSegment<Child, Root>&>(segment).for_each(f);
+            return true;
+        }
+        return forEachListed<Listed...>(segment, f);
+    }
+
+private:
+};
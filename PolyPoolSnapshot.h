@@ -0,0 +1,349 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define POLYPOOL_HAS_MMAP 1
+#endif
+
+#include "PolyPoolMemory.h"
+
+/** How the items of a type are stored in a snapshot, see
+    PolyPool::save().
+
+    Trivially copyable types need nothing: their blocks are stored as
+    raw images and loaded wholesale. Other types, such as any type
+    with virtual functions, opt in by specializing with two functions
+    working on a record of sizeof(Child) bytes. load() constructs an
+    item in a slot, which also sets up its vtable pointer:
+
+        template <>
+        struct PolyPoolSnapshot<Particle>
+        {
+            static void save(const Particle& item, unsigned char* record)
+            {
+                std::memcpy(record, &item.state, sizeof(item.state));
+            }
+            static void load(const unsigned char* record, void* slot)
+            {
+                Particle::State state;
+                std::memcpy(&state, record, sizeof(state));
+                new (slot) Particle(state);
+            }
+        };
+ */
+template <typename Child>
+struct PolyPoolSnapshot
+{
+};
+
+/// Tags for how the items of a type are stored in a snapshot.
+struct PolyPoolSnapshotBitwise
+{
+};
+struct PolyPoolSnapshotHooked
+{
+};
+struct PolyPoolSnapshotUnsupported
+{
+};
+
+/// Picks how the items of a type are stored in a snapshot.
+template <typename Child>
+class PolyPoolSnapshotTraits
+{
+    template <typename T>
+    static auto test(int)
+        -> decltype(PolyPoolSnapshot<T>::save(std::declval<const T&>(), static_cast<unsigned char*>(nullptr)),
+                    PolyPoolSnapshot<T>::load(static_cast<const unsigned char*>(nullptr), static_cast<void*>(nullptr)),
+                    std::true_type());
+    template <typename T>
+    static std::false_type test(long);
+
+    using hooked=decltype(test<Child>(0));
+
+public:
+    using method=typename std::conditional<
+        hooked::value, PolyPoolSnapshotHooked,
+        typename std::conditional<std::is_trivially_copyable<Child>::value,
+                                  PolyPoolSnapshotBitwise,
+                                  PolyPoolSnapshotUnsupported>::type>::type;
+};
+
+
+/** Layout of snapshot files, version 1. All numbers are 64 bit in the
+    byte order of the writer.
+
+    - header: the magic "PolyPool", the version, a byte order mark and
+      the number of segments
+    - per segment: a key naming the type, its slot stride and block
+      alignment, and the number of blocks
+    - per block: capacity, used slots and live bitmap, then, from the
+      next multiple of imageAlignment() in the file, an image of all
+      its slots
+ */
+struct PolyPoolSnapshotFormat
+{
+    using size_type=std::size_t;
+
+    static const char* magic()
+    {
+        return "PolyPool";
+    }
+    static std::uint64_t version()
+    {
+        return 1;
+    }
+    static std::uint64_t byteOrder()
+    {
+        return 0x0102030405060708;
+    }
+    /// Bytes of the live bitmap of a block.
+    static size_type bitmapBytes(size_type capacity)
+    {
+        return (capacity + 63) / 64 * 8;
+    }
+    /// Alignment of block images within the file, so they can be used in place.
+    static size_type imageAlignment(size_type alignment)
+    {
+        return alignment > 64 ? alignment : 64;
+    }
+};
+
+
+/** Writes a snapshot file. The file is written under a temporary
+    name and renamed into place by close(), so a snapshot being loaded
+    from, or in use by a pool, is never overwritten midway.
+    Throws std::runtime_error on I/O errors.
+ */
+class PolyPoolSnapshotWriter
+{
+public:
+    using size_type=std::size_t;
+
+    PolyPoolSnapshotWriter(const std::string& path, size_type segments)
+        : mPath(path)
+        , mTemporary(path + ".tmp")
+        , mFile(std::fopen(mTemporary.c_str(), "wb"))
+    {
+        if (not mFile) throw std::runtime_error("Cannot create snapshot file " + mTemporary);
+        write(PolyPoolSnapshotFormat::magic(), 8);
+        writeValue(PolyPoolSnapshotFormat::version());
+        writeValue(PolyPoolSnapshotFormat::byteOrder());
+        writeValue(segments);
+    }
+
+    PolyPoolSnapshotWriter(const PolyPoolSnapshotWriter&) = delete;
+    PolyPoolSnapshotWriter& operator=(const PolyPoolSnapshotWriter&) = delete;
+
+    /// Discards the file unless close() succeeded.
+    ~PolyPoolSnapshotWriter()
+    {
+        if (mFile)
+        {
+            std::fclose(mFile);
+            std::remove(mTemporary.c_str());
+        }
+    }
+
+    void write(const void* data, size_type bytes)
+    {
+        if (bytes and std::fwrite(data, 1, bytes, mFile) != bytes)
+        {
+            throw std::runtime_error("Cannot write snapshot file " + mTemporary);
+        }
+        mOffset += bytes;
+    }
+    void writeValue(std::uint64_t value)
+    {
+        write(&value, sizeof(value));
+    }
+    void writeString(const std::string& value)
+    {
+        writeValue(value.size());
+        write(value.data(), value.size());
+    }
+    /// Write bytes zeros.
+    void writeZeros(size_type bytes)
+    {
+        static const unsigned char zeros[4096] = {};
+        while (bytes > 0)
+        {
+            const size_type count = bytes < sizeof(zeros) ? bytes : sizeof(zeros);
+            write(zeros, count);
+            bytes -= count;
+        }
+    }
+    /// Pad with zeros up to a multiple of alignment from the start of the file.
+    void align(size_type alignment)
+    {
+        writeZeros((alignment - mOffset % alignment) % alignment);
+    }
+
+    /// Finish the file and move it into place.
+    void close()
+    {
+        std::FILE* file = mFile;
+        mFile = nullptr;
+        if (std::fclose(file) != 0)
+        {
+            std::remove(mTemporary.c_str());
+            throw std::runtime_error("Cannot write snapshot file " + mTemporary);
+        }
+#ifndef POLYPOOL_HAS_MMAP
+        // Renaming onto an existing file fails on some systems.
+        std::remove(mPath.c_str());
+#endif
+        if (std::rename(mTemporary.c_str(), mPath.c_str()) != 0)
+        {
+            std::remove(mTemporary.c_str());
+            throw std::runtime_error("Cannot replace snapshot file " + mPath);
+        }
+    }
+
+private:
+    std::string mPath;
+    std::string mTemporary;
+    std::FILE* mFile;
+    size_type mOffset = 0;
+};
+
+
+/** A snapshot file being loaded, mapped into memory where mmap is
+    available and read into memory otherwise.
+
+    The mapping is private and writable, so blocks can be adopted in
+    place: their pages are read from the file on first touch and
+    copied once written to, and the file itself never changes. Pools
+    that adopted blocks keep the file alive until they let go of them.
+    Throws std::runtime_error on I/O errors and malformed files.
+ */
+class PolyPoolSnapshotFile
+{
+public:
+    using size_type=std::size_t;
+
+    explicit PolyPoolSnapshotFile(const std::string& path)
+        : mPath(path)
+    {
+#ifdef POLYPOOL_HAS_MMAP
+        const int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0) throw std::runtime_error("Cannot open snapshot file " + path);
+        struct stat info;
+        if (::fstat(file, &info) == 0 and info.st_size > 0)
+        {
+            mSize = size_type(info.st_size);
+            void* data = ::mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+            mData = data == MAP_FAILED ? nullptr : static_cast<unsigned char*>(data);
+        }
+        ::close(file);
+        if (not mData) throw std::runtime_error("Cannot map snapshot file " + path);
+#else
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (not file) throw std::runtime_error("Cannot open snapshot file " + path);
+        long size = -1;
+        if (std::fseek(file, 0, SEEK_END) == 0) size = std::ftell(file);
+        if (size > 0 and std::fseek(file, 0, SEEK_SET) == 0)
+        {
+            mSize = size_type(size);
+            mData = static_cast<unsigned char*>(
+                PolyPoolMemoryResource::defaultResource()->allocate(mSize, bufferAlignment()));
+            if (std::fread(mData, 1, mSize, file) != mSize)
+            {
+                PolyPoolMemoryResource::defaultResource()->deallocate(mData, mSize, bufferAlignment());
+                mData = nullptr;
+            }
+        }
+        std::fclose(file);
+        if (not mData) throw std::runtime_error("Cannot read snapshot file " + path);
+#endif
+    }
+
+    PolyPoolSnapshotFile(const PolyPoolSnapshotFile&) = delete;
+    PolyPoolSnapshotFile& operator=(const PolyPoolSnapshotFile&) = delete;
+
+    ~PolyPoolSnapshotFile()
+    {
+#ifdef POLYPOOL_HAS_MMAP
+        ::munmap(mData, mSize);
+#else
+        PolyPoolMemoryResource::defaultResource()->deallocate(mData, mSize, bufferAlignment());
+#endif
+    }
+
+    /// Check the header and return the number of segments.
+    size_type readHeader()
+    {
+        if (std::memcmp(take(8), PolyPoolSnapshotFormat::magic(), 8) != 0)
+        {
+            throw std::runtime_error("Not a snapshot file: " + mPath);
+        }
+        if (readValue() != PolyPoolSnapshotFormat::version())
+        {
+            throw std::runtime_error("Unsupported snapshot version in " + mPath);
+        }
+        if (readValue() != PolyPoolSnapshotFormat::byteOrder())
+        {
+            throw std::runtime_error("Snapshot written with another byte order: " + mPath);
+        }
+        return size_type(readValue());
+    }
+
+    /// The next bytes of the file, which may be written to.
+    unsigned char* take(size_type bytes)
+    {
+        if (bytes > mSize - mOffset)
+        {
+            throw std::runtime_error("Snapshot file is truncated: " + mPath);
+        }
+        unsigned char* data = mData + mOffset;
+        mOffset += bytes;
+        return data;
+    }
+    std::uint64_t readValue()
+    {
+        std::uint64_t value;
+        std::memcpy(&value, take(sizeof(value)), sizeof(value));
+        return value;
+    }
+    std::string readString()
+    {
+        const size_type size = size_type(readValue());
+        const unsigned char* data = take(size);
+        return std::string(reinterpret_cast<const char*>(data), size);
+    }
+    /// Skip to the next multiple of alignment from the start of the file.
+    void align(size_type alignment)
+    {
+        take((alignment - mOffset % alignment) % alignment);
+    }
+
+    const std::string& path() const
+    {
+        return mPath;
+    }
+
+private:
+#ifndef POLYPOOL_HAS_MMAP
+    static size_type bufferAlignment()
+    {
+        return 4096;
+    }
+#endif
+
+    std::string mPath;
+    unsigned char* mData = nullptr;
+    size_type mSize = 0;
+    size_type mOffset = 0;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+
+/** A view of count contiguous elements, such as a column of a
+    PolyPoolColumns block. Does not own the elements.
+ */
+template <typename T>
+class PolyPoolSpan
+{
+public:
+    using size_type=std::size_t;
+    using value_type=T;
+    using iterator=T*;
+
+    PolyPoolSpan() = default;
+    PolyPoolSpan(T* data, size_type size)
+        : mData(data)
+        , mSize(size)
+    {
+    }
+
+    T* data() const
+    {
+        return mData;
+    }
+    size_type size() const
+    {
+        return mSize;
+    }
+    bool empty() const
+    {
+        return mSize == 0;
+    }
+
+    T& operator[](size_type index) const
+    {
+        return mData[index];
+    }
+
+    iterator begin() const
+    {
+        return mData;
+    }
+    iterator end() const
+    {
+        return mData + mSize;
+    }
+
+private:
+    T* mData = nullptr;
+    size_type mSize = 0;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <locale>
+#include <sstream>
+#include <string>
+
+/** Snapshot of the counters of a segment, or of a whole pool.
+
+    Counters are kept as items and blocks come and go, so taking a
+    snapshot costs a few additions per type. Cumulative counters run
+    from the creation of the segment; the others describe its current
+    state.
+ */
+struct PolyPoolStats
+{
+    using size_type=std::size_t;
+
+    /// Items constructed, cumulative.
+    size_type allocations = 0;
+    /// Allocations served by reusing a free slot, cumulative.
+    size_type reuses = 0;
+    /// Blocks allocated, cumulative.
+    size_type blocksCreated = 0;
+    /// Blocks deallocated by shrink_to_fit() or clear(), cumulative.
+    size_type blocksReleased = 0;
+    /// Free slots stepped over by for_each() passes, cumulative.
+    size_type holesSkipped = 0;
+
+    size_type blocks = 0;
+    size_type active = 0;
+    size_type holes = 0;
+    /// Released items kept constructed for reuse.
+    size_type warm = 0;
+    size_type capacity = 0;
+    /// Bytes of block storage held.
+    size_type bytesReserved = 0;
+    /// Bytes of block storage holding live items.
+    size_type bytesLive = 0;
+
+    /// Share of used slots that are free, from 0 to 1.
+    double fragmentation() const
+    {
+        return active + holes == 0 ? 0.0 : double(holes) / double(active + holes);
+    }
+
+    PolyPoolStats& operator+=(const PolyPoolStats& rhs)
+    {
+        allocations += rhs.allocations;
+        reuses += rhs.reuses;
+        blocksCreated += rhs.blocksCreated;
+        blocksReleased += rhs.blocksReleased;
+        holesSkipped += rhs.holesSkipped;
+        blocks += rhs.blocks;
+        active += rhs.active;
+        holes += rhs.holes;
+        warm += rhs.warm;
+        capacity += rhs.capacity;
+        bytesReserved += rhs.bytesReserved;
+        bytesLive += rhs.bytesLive;
+        return *this;
+    }
+
+    /// All counters and the fragmentation ratio as a JSON object.
+    std::string json() const
+    {
+        std::ostringstream out;
+        out.imbue(std::locale::classic());
+        out << "{\"allocations\":" << allocations
+            << ",\"reuses\":" << reuses
+            << ",\"blocksCreated\":" << blocksCreated
+            << ",\"blocksReleased\":" << blocksReleased
+            << ",\"holesSkipped\":" << holesSkipped
+            << ",\"blocks\":" << blocks
+            << ",\"active\":" << active
+            << ",\"holes\":" << holes
+            << ",\"warm\":" << warm
+            << ",\"capacity\":" << capacity
+            << ",\"bytesReserved\":" << bytesReserved
+            << ",\"bytesLive\":" << bytesLive
+            << ",\"fragmentation\":" << fragmentation()
+            << "}";
+        return out.str();
+    }
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <type_traits>
+#include <typeinfo>
+
+/** The type an item seen through a Child* is filed under.
+
+    typeid only looks up the dynamic type of polymorphic objects; for
+    any other type it gives the static one, which for an item seen
+    through a pointer to its base is the base. So items are filed
+    under their dynamic type only when Child is polymorphic and may
+    have subtypes, and under Child otherwise. Items of a
+    non-polymorphic root must thus be given through a pointer to their
+    exact type.
+ */
+template <typename Child>
+struct PolyPoolFiledType
+{
+#if __cplusplus >= 201402L
+    static constexpr bool dynamic = std::is_polymorphic<Child>::value and not std::is_final<Child>::value;
+#else
+    static constexpr bool dynamic = std::is_polymorphic<Child>::value and not __is_final(Child);
+#endif
+
+    static const std::type_info& of(const Child* item)
+    {
+        return of(item, std::integral_constant<bool, dynamic>());
+    }
+
+private:
+    static const std::type_info& of(const Child* item, std::true_type)
+    {
+        return typeid(*item);
+    }
+    static const std::type_info& of(const Child*, std::false_type)
+    {
+        return typeid(Child);
+    }
+};
+
+template <typename Child>
+constexpr bool PolyPoolFiledType<Child>::dynamic;
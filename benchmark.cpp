@@ -0,0 +1,459 @@
+#include "PolyPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <tuple>
+#include <vector>
+
+/** Microbenchmarks of PolyPool against common alternatives.
+
+    Each run inserts size objects spread round-robin over a number of
+    types, destroys a share of them (the hole density) in random
+    order, iterates the rest through virtual calls and by static type,
+    and finally inserts as many objects again to reuse the holes.
+
+    Containers compared:
+    * polypool: the open-world PolyPool<Root>
+    * polypool_closed: the closed-world PolyPool<Root, Types...>
+    * vector_unique_ptr: std::vector<std::unique_ptr<Root>>, holes kept
+      as null pointers and refilled in place
+    * vector_per_type: a std::vector per type, holes compacted away
+
+    Results are written to stdout as CSV, one line per operation, in
+    nanoseconds per object. Pass --quick for a smaller sweep.
+ */
+
+struct Root
+{
+    virtual ~Root() {}
+    virtual long value() const = 0;
+};
+
+// final, so that calls through Item<Type>& in the typed passes are
+// devirtualized.
+template <int Type>
+struct Item final : public Root
+{
+    explicit Item(long valueIn) : mValue(valueIn) {}
+    long value() const override { return mValue + Type; }
+    long mValue;
+    long mPadding[3];
+};
+
+const int maxTypes = 8;
+
+using OpenPool=PolyPool<Root>;
+using ClosedPool=PolyPool<Root, Item<0>, Item<1>, Item<2>, Item<3>,
+                          Item<4>, Item<5>, Item<6>, Item<7> >;
+
+struct Config
+{
+    std::size_t size;
+    int types;
+    double holes;
+    std::size_t blockSize;
+};
+
+/// Call f.template apply<Type>() for the runtime type index type.
+template <int Type>
+struct Dispatch
+{
+    template <typename F>
+    static void apply(int type, F& f)
+    {
+        if (type == Type) f.template apply<Type>();
+        else Dispatch<Type + 1>::apply(type, f);
+    }
+};
+template <>
+struct Dispatch<maxTypes>
+{
+    template <typename F>
+    static void apply(int, F&)
+    {
+    }
+};
+
+class Timer
+{
+public:
+    Timer() : mStart(std::chrono::steady_clock::now()) {}
+
+    double nanoseconds() const
+    {
+        return std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - mStart).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point mStart;
+};
+
+/// Fastest of a few runs of f, in nanoseconds, for repeatable operations.
+template <typename F>
+double fastest(F&& f)
+{
+    double best = 0;
+    for (int run = 0; run < 5; run++)
+    {
+        Timer timer;
+        f();
+        const double elapsed = timer.nanoseconds();
+        if (run == 0 or elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+/// Sink that keeps the optimizer from dropping iteration results.
+volatile long gSink = 0;
+
+void report(const char* operation, const char* container, const Config& config,
+            std::size_t blockSize, double nanoseconds, std::size_t count)
+{
+    if (count == 0) return;
+    std::printf("%s,%s,%zu,%d,%.2f,%zu,%.3f\n", operation, container, config.size,
+                config.types, config.holes, blockSize, nanoseconds / count);
+}
+
+/// Random order of the indices of the objects to destroy.
+std::vector<std::size_t> holeIndices(const Config& config)
+{
+    std::vector<std::size_t> indices(config.size);
+    for (std::size_t index = 0; index < indices.size(); index++) indices[index] = index;
+    std::mt19937 random(42);
+    std::shuffle(indices.begin(), indices.end(), random);
+    indices.resize(std::size_t(config.size * config.holes));
+    return indices;
+}
+
+struct SumRoot
+{
+    long sum = 0;
+    void operator()(Root& item) { sum += item.value(); }
+};
+struct SumTyped
+{
+    long sum = 0;
+    template <typename Child>
+    void operator()(Child& item) { sum += item.value(); }
+};
+
+
+template <typename Pool>
+struct PoolInsert
+{
+    Pool& pool;
+    std::vector<Root*>& items;
+    long value;
+
+    template <int Type>
+    void apply()
+    {
+        items.push_back(pool.template emplace<Item<Type> >(value));
+    }
+};
+
+template <typename Pool>
+struct PoolDestroy
+{
+    Pool& pool;
+    Root* item;
+
+    template <int Type>
+    void apply()
+    {
+        pool.destroy(static_cast<Item<Type>*>(item));
+    }
+};
+
+template <typename Pool>
+void benchmarkPool(const char* container, const Config& config)
+{
+    Pool pool(config.blockSize);
+    std::vector<Root*> items;
+    items.reserve(config.size);
+    {
+        Timer timer;
+        for (std::size_t index = 0; index < config.size; index++)
+        {
+            PoolInsert<Pool> insert{pool, items, long(index)};
+            Dispatch<0>::apply(int(index % config.types), insert);
+        }
+        report("insert", container, config, config.blockSize, timer.nanoseconds(), config.size);
+    }
+
+    const std::vector<std::size_t> holes = holeIndices(config);
+    {
+        Timer timer;
+        for (std::size_t index : holes)
+        {
+            PoolDestroy<Pool> destroy{pool, items[index]};
+            Dispatch<0>::apply(int(index % config.types), destroy);
+        }
+        report("destroy", container, config, config.blockSize, timer.nanoseconds(), holes.size());
+    }
+
+    const std::size_t live = config.size - holes.size();
+    report("iterate_virtual", container, config, config.blockSize, fastest([&]
+    {
+        SumRoot sum;
+        pool.for_each(sum);
+        gSink = sum.sum;
+    }), live);
+    report("iterate_typed", container, config, config.blockSize, fastest([&]
+    {
+        SumTyped sum;
+        pool.template for_each<Item<0>, Item<1>, Item<2>, Item<3>,
+                               Item<4>, Item<5>, Item<6>, Item<7> >(sum);
+        gSink = sum.sum;
+    }), live);
+    report("iterate_one_type", container, config, config.blockSize, fastest([&]
+    {
+        long sum = 0;
+        const auto end = pool.template end<Item<0> >();
+        for (auto item = pool.template begin<Item<0> >(); item != end; ++item)
+        {
+            sum += item->value();
+        }
+        gSink = sum;
+    }), pool.template active<Item<0> >());
+    {
+        items.clear();
+        Timer timer;
+        for (std::size_t index = 0; index < holes.size(); index++)
+        {
+            PoolInsert<Pool> insert{pool, items, long(index)};
+            Dispatch<0>::apply(int(index % config.types), insert);
+        }
+        report("reuse", container, config, config.blockSize, timer.nanoseconds(), holes.size());
+    }
+}
+
+
+struct PointerInsert
+{
+    std::unique_ptr<Root>& slot;
+    long value;
+
+    template <int Type>
+    void apply()
+    {
+        slot.reset(new Item<Type>(value));
+    }
+};
+
+void benchmarkPointers(const Config& config)
+{
+    const char* container = "vector_unique_ptr";
+    std::vector<std::unique_ptr<Root> > items;
+    items.reserve(config.size);
+    {
+        Timer timer;
+        for (std::size_t index = 0; index < config.size; index++)
+        {
+            items.emplace_back();
+            PointerInsert insert{items.back(), long(index)};
+            Dispatch<0>::apply(int(index % config.types), insert);
+        }
+        report("insert", container, config, 0, timer.nanoseconds(), config.size);
+    }
+
+    const std::vector<std::size_t> holes = holeIndices(config);
+    {
+        Timer timer;
+        for (std::size_t index : holes)
+        {
+            items[index].reset();
+        }
+        report("destroy", container, config, 0, timer.nanoseconds(), holes.size());
+    }
+
+    const std::size_t live = config.size - holes.size();
+    report("iterate_virtual", container, config, 0, fastest([&]
+    {
+        long sum = 0;
+        for (auto& item : items)
+        {
+            if (item) sum += item->value();
+        }
+        gSink = sum;
+    }), live);
+    {
+        Timer timer;
+        for (std::size_t index = 0; index < holes.size(); index++)
+        {
+            PointerInsert insert{items[holes[index]], long(index)};
+            Dispatch<0>::apply(int(index % config.types), insert);
+        }
+        report("reuse", container, config, 0, timer.nanoseconds(), holes.size());
+    }
+}
+
+
+using VectorPerType=std::tuple<std::vector<Item<0> >, std::vector<Item<1> >,
+                               std::vector<Item<2> >, std::vector<Item<3> >,
+                               std::vector<Item<4> >, std::vector<Item<5> >,
+                               std::vector<Item<6> >, std::vector<Item<7> > >;
+
+struct VectorInsert
+{
+    VectorPerType& vectors;
+    long value;
+
+    template <int Type>
+    void apply()
+    {
+        std::get<Type>(vectors).emplace_back(value);
+    }
+};
+
+/// Mark an item dead, by setting its value to -1.
+struct VectorMark
+{
+    VectorPerType& vectors;
+    std::size_t position;
+
+    template <int Type>
+    void apply()
+    {
+        std::get<Type>(vectors)[position].mValue = -1;
+    }
+};
+
+/// Remove the items marked dead.
+struct VectorCompact
+{
+    VectorPerType& vectors;
+
+    template <int Type>
+    void apply()
+    {
+        auto& vector = std::get<Type>(vectors);
+        vector.erase(std::remove_if(vector.begin(), vector.end(),
+                                    [](const Item<Type>& item) { return item.mValue < 0; }),
+                     vector.end());
+    }
+};
+
+struct VectorSum
+{
+    VectorPerType& vectors;
+    long sum;
+
+    template <int Type>
+    void apply()
+    {
+        for (auto& item : std::get<Type>(vectors))
+        {
+            sum += item.value();
+        }
+    }
+};
+
+void benchmarkVectors(const Config& config)
+{
+    const char* container = "vector_per_type";
+    VectorPerType vectors;
+    // Where each object landed, to find it again for destroying.
+    std::vector<std::pair<int, std::size_t> > items;
+    items.reserve(config.size);
+    {
+        Timer timer;
+        for (std::size_t index = 0; index < config.size; index++)
+        {
+            VectorInsert insert{vectors, long(index)};
+            Dispatch<0>::apply(int(index % config.types), insert);
+        }
+        report("insert", container, config, 0, timer.nanoseconds(), config.size);
+    }
+    for (std::size_t index = 0; index < config.size; index++)
+    {
+        items.emplace_back(int(index % config.types), index / config.types);
+    }
+
+    const std::vector<std::size_t> holes = holeIndices(config);
+    {
+        Timer timer;
+        for (std::size_t index : holes)
+        {
+            VectorMark mark{vectors, items[index].second};
+            Dispatch<0>::apply(items[index].first, mark);
+        }
+        for (int type = 0; type < config.types; type++)
+        {
+            VectorCompact compact{vectors};
+            Dispatch<0>::apply(type, compact);
+        }
+        report("destroy", container, config, 0, timer.nanoseconds(), holes.size());
+    }
+
+    const std::size_t live = config.size - holes.size();
+    report("iterate_typed", container, config, 0, fastest([&]
+    {
+        VectorSum sum{vectors, 0};
+        for (int type = 0; type < config.types; type++)
+        {
+            Dispatch<0>::apply(type, sum);
+        }
+        gSink = sum.sum;
+    }), live);
+    report("iterate_one_type", container, config, 0, fastest([&]
+    {
+        VectorSum sum{vectors, 0};
+        sum.apply<0>();
+        gSink = sum.sum;
+    }), std::get<0>(vectors).size());
+    {
+        Timer timer;
+        for (std::size_t index = 0; index < holes.size(); index++)
+        {
+            VectorInsert insert{vectors, long(index)};
+            Dispatch<0>::apply(int(index % config.types), insert);
+        }
+        report("reuse", container, config, 0, timer.nanoseconds(), holes.size());
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    const bool quick = argc > 1 and std::strcmp(argv[1], "--quick") == 0;
+
+    const std::vector<std::size_t> sizes = quick
+        ? std::vector<std::size_t>{10000}
+        : std::vector<std::size_t>{1000, 100000, 1000000};
+    const std::vector<int> typeCounts = quick
+        ? std::vector<int>{4}
+        : std::vector<int>{1, 4, 8};
+    const std::vector<double> holeDensities = quick
+        ? std::vector<double>{0.5}
+        : std::vector<double>{0.0, 0.25, 0.5, 0.9};
+    const std::vector<std::size_t> blockSizes = quick
+        ? std::vector<std::size_t>{256}
+        : std::vector<std::size_t>{20, 256, 4096};
+
+    std::printf("operation,container,size,types,holes,block_size,ns_per_object\n");
+    for (std::size_t size : sizes)
+    {
+        for (int types : typeCounts)
+        {
+            for (double holes : holeDensities)
+            {
+                Config config{size, types, holes, 0};
+                benchmarkPointers(config);
+                benchmarkVectors(config);
+                for (std::size_t blockSize : blockSizes)
+                {
+                    config.blockSize = blockSize;
+                    benchmarkPool<OpenPool>("polypool", config);
+                    benchmarkPool<ClosedPool>("polypool_closed", config);
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -1,2 +1,4 @@
 #! /usr/bin/env sh
-g++ -g -std=c++11 demo.cpp -o demo -I./poly_collection/include/ &> log
+g++ -g -std=c++11 demo.cpp -o demo &> log
+g++ -O2 -std=c++11 -pthread benchmark.cpp -o benchmark &>> log
+g++ -g -std=c++11 -pthread tests.cpp -o tests &>> log
@@ -0,0 +1,1723 @@
+#include "PolyPool.h"
+#include "PolyPoolClosed.h"
+#include "PolyPoolColumns.h"
+#include "PolyPoolConcurrent.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include "PolyPoolMapped.h"
+#endif
+#include "PolyPoolShared.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+/** Regression tests for PolyPool.
+
+    Each test checks one behaviour through the public interface. The
+    program prints every failed check and exits non-zero if any
+    failed. Build with build.sh, which also builds the demo and the
+    benchmark.
+ */
+
+static int gFailures = 0;
+
+static void check(bool condition, const char* test, const char* what)
+{
+    if (condition) return;
+    std::printf("FAILED %s: %s\n", test, what);
+    ++gFailures;
+}
+
+/// Calls of the global operator new, to catch allocations bypassing a pool's resource.
+static std::atomic<long> gNews(0);
+
+void* operator new(std::size_t bytes)
+{
+    ++gNews;
+    void* p = std::malloc(bytes ? bytes : 1);
+    if (not p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+#if __cpp_sized_deallocation
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+#endif
+
+/** Resource counting its allocations still outstanding. Draws from
+    malloc rather than the global operator new, so that gNews only
+    counts allocations made elsewhere. Over-aligned requests still go
+    to the default resource.
+ */
+struct CountingResource : public PolyPoolMemoryResource
+{
+    long live = 0;
+
+protected:
+    void* doAllocate(size_type bytes, size_type alignment) override
+    {
+        ++live;
+        if (alignment > alignof(std::max_align_t))
+        {
+            return PolyPoolMemoryResource::defaultResource()->allocate(bytes, alignment);
+        }
+        void* p = std::malloc(bytes ? bytes : 1);
+        if (not p) throw std::bad_alloc();
+        return p;
+    }
+    void doDeallocate(void* p, size_type bytes, size_type alignment) override
+    {
+        --live;
+        if (alignment > alignof(std::max_align_t))
+        {
+            PolyPoolMemoryResource::defaultResource()->deallocate(p, bytes, alignment);
+            return;
+        }
+        std::free(p);
+    }
+};
+
+/// Live instances of the types below, to catch double and missed destruction.
+static std::atomic<long> gAlive(0);
+
+struct Root
+{
+    virtual ~Root() {}
+    virtual long value() const = 0;
+};
+
+struct Base : public Root
+{
+    explicit Base(long valueIn) : mValue(valueIn) { ++gAlive; }
+    Base(const Base& other) : Root(), mValue(other.mValue) { ++gAlive; }
+    ~Base() { --gAlive; }
+    long value() const override { return mValue; }
+    long mValue;
+};
+
+struct Derived : public Base
+{
+    explicit Derived(long valueIn) : Base(valueIn), mExtra(valueIn) {}
+    long value() const override { return mValue + mExtra; }
+    long mExtra;
+};
+
+struct Other : public Root
+{
+    explicit Other(long valueIn) : mName(std::to_string(valueIn)) { ++gAlive; }
+    Other(const Other& other) : Root(), mName(other.mName) { ++gAlive; }
+    ~Other() { --gAlive; }
+    long value() const override { return std::stol(mName); }
+    std::string mName;
+};
+
+/// Throws once a budget of constructions is used up.
+struct Fragile : public Root
+{
+    static long budget;
+
+    explicit Fragile(long valueIn) : mValue(valueIn)
+    {
+        if (--budget < 0) throw std::runtime_error("construction budget used up");
+        ++gAlive;
+    }
+    Fragile(const Fragile& other) : Fragile(other.mValue) {}
+    ~Fragile() { --gAlive; }
+    long value() const override { return mValue; }
+    long mValue;
+};
+long Fragile::budget = 0;
+
+/// Counts the visits it gets from several threads.
+struct Tally : public Root
+{
+    Tally() { ++gAlive; }
+    ~Tally() { --gAlive; }
+    long value() const override { return visits; }
+    std::atomic<long> visits{0};
+};
+
+/// Holds a buffer worth keeping across uses, see PolyPool::release().
+struct Connection : public Root
+{
+    static long resets;
+
+    explicit Connection(long idIn) : buffer(4096), id(idIn) { ++gAlive; }
+    Connection(const Connection& other) : Root(), buffer(other.buffer), id(other.id) { ++gAlive; }
+    ~Connection() { --gAlive; }
+    long value() const override { return id; }
+    void reset() { ++resets; }
+    std::vector<char> buffer;
+    long id;
+};
+long Connection::resets = 0;
+
+/// Move-only and not assignable, so only ever constructed in place.
+struct Unique : public Root
+{
+    Unique(std::unique_ptr<long> ownedIn, std::string nameIn)
+        : owned(std::move(ownedIn))
+        , name(std::move(nameIn))
+    {
+        ++gAlive;
+    }
+    Unique(Unique&& other) : Root(), owned(std::move(other.owned)), name(other.name) { ++gAlive; }
+    ~Unique() { --gAlive; }
+    long value() const override { return *owned; }
+    std::unique_ptr<long> owned;
+    const std::string name;
+};
+
+/// Over-aligned, so its slots must honor alignof.
+struct alignas(64) Wide : public Root
+{
+    explicit Wide(long valueIn) : mValue(valueIn) { ++gAlive; }
+    ~Wide() { --gAlive; }
+    long value() const override { return mValue; }
+    long mValue;
+};
+
+/// Laid out with the cache-line layouts, see PolyPoolLayout.
+struct Padded : public Root
+{
+    explicit Padded(long valueIn) : mValue(valueIn) {}
+    long value() const override { return mValue; }
+    long mValue;
+};
+struct Aligned : public Root
+{
+    explicit Aligned(long valueIn) : mValue(valueIn) {}
+    long value() const override { return mValue; }
+    long mValue;
+};
+
+template <>
+struct PolyPoolLayout<Padded> : PolyPoolPaddedLayout<Padded>
+{
+};
+template <>
+struct PolyPoolLayout<Aligned> : PolyPoolAlignedLayout<Aligned>
+{
+};
+
+/// Trivially copyable types, stored bitwise in snapshots.
+struct Plain
+{
+    long id;
+};
+struct PlainA : public Plain
+{
+    double weight;
+};
+struct PlainB : public Plain
+{
+    char tag[24];
+};
+
+/// A type with virtual functions, stored through snapshot hooks.
+struct Particle : public Root
+{
+    struct State
+    {
+        long x;
+        long vx;
+    };
+    explicit Particle(State stateIn) : state(stateIn) {}
+    long value() const override { return state.x * 10 + state.vx; }
+    State state;
+};
+
+template <>
+struct PolyPoolSnapshot<Particle>
+{
+    static void save(const Particle& item, unsigned char* record)
+    {
+        std::memcpy(record, &item.state, sizeof(item.state));
+    }
+    static void load(const unsigned char* record, void* slot)
+    {
+        Particle::State state;
+        std::memcpy(&state, record, sizeof(state));
+        new (slot) Particle(state);
+    }
+};
+
+/// A plain-data type stored in columns.
+struct Body
+{
+    float x;
+    float y;
+    int id;
+};
+
+template <>
+struct PolyPoolFields<Body>
+{
+    static std::tuple<float Body::*, float Body::*, int Body::*> members()
+    {
+        return std::make_tuple(&Body::x, &Body::y, &Body::id);
+    }
+};
+
+template <typename Pool>
+long sum(Pool& pool)
+{
+    long total = 0;
+    for (auto& item : pool) total += item.value();
+    return total;
+}
+
+
+void testSmallTypeReuse()
+{
+    const char* test = "small type reuse";
+    PolyPool<std::uint16_t> pool(16);
+    std::vector<std::uint16_t*> items;
+    for (std::uint16_t i = 0; i < 200; i++)
+    {
+        items.push_back(pool.emplace<std::uint16_t>(i));
+    }
+    for (std::size_t i = 0; i < items.size(); i += 2)
+    {
+        pool.destroy(items[i]);
+    }
+    bool intact = true;
+    for (std::size_t i = 1; i < items.size(); i += 2)
+    {
+        intact = intact and *items[i] == i;
+    }
+    check(intact, test, "freeing slots corrupts neighbouring items");
+
+    const std::size_t capacity = pool.capacity();
+    for (std::uint16_t i = 0; i < 100; i++)
+    {
+        pool.emplace<std::uint16_t>(std::uint16_t(1000 + i));
+    }
+    check(pool.capacity() == capacity, test, "free slots are not reused");
+    for (std::size_t i = 1; i < items.size(); i += 2)
+    {
+        intact = intact and *items[i] == i;
+    }
+    check(intact, test, "reusing slots corrupts neighbouring items");
+    check(pool.active() == 200, test, "wrong number of active items");
+}
+
+void testBaseDestroyOpen()
+{
+    const char* test = "base pointer destroy, open world";
+    {
+        PolyPool<Root> pool(8);
+        Base* base = pool.emplace<Base>(1);
+        Base* derived = pool.emplace<Derived>(2);
+        Root* other = pool.emplace<Other>(3);
+        pool.destroy(derived);
+        check(pool.active<Derived>() == 0 and pool.active<Base>() == 1, test,
+              "object destroyed through its base is filed under the wrong type");
+        pool.destroy(other);
+        check(pool.active() == 1 and gAlive == 1, test, "wrong objects destroyed");
+        Root* range[] = {pool.emplace<Derived>(4), pool.emplace<Other>(5), base};
+        pool.destroy(range, range + 3);
+        check(pool.active() == 0 and gAlive == 0, test, "destroying a range of base pointers");
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+
+void testBaseDestroyClosed()
+{
+    const char* test = "base pointer destroy, closed world";
+    {
+        PolyPool<Root, Base, Derived, Other> pool(8);
+        Base* base = pool.emplace<Base>(1);
+        Base* derived = pool.emplace<Derived>(2);
+        Root* other = pool.emplace<Other>(3);
+        pool.destroy(derived);
+        check(pool.active<Derived>() == 0 and pool.active<Base>() == 1, test,
+              "object destroyed through its base is filed under the wrong type");
+        pool.destroy(other);
+        check(pool.active() == 1 and gAlive == 1, test, "wrong objects destroyed");
+        Root* range[] = {pool.emplace<Derived>(4), pool.emplace<Other>(5), base};
+        pool.destroy(range, range + 3);
+        check(pool.active() == 0 and gAlive == 0, test, "destroying a range of base pointers");
+
+        Derived outside(6);
+        bool thrown = false;
+        try
+        {
+            pool.destroy(static_cast<Base*>(&outside));
+        }
+        catch (const std::invalid_argument&)
+        {
+            thrown = true;
+        }
+        check(thrown, test, "destroying a foreign object is not rejected");
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+
+void testPlainRootDestroy()
+{
+    const char* test = "destroy with a non-polymorphic root";
+    PolyPool<Plain> pool(8);
+    std::vector<PlainA*> as;
+    std::vector<Plain*> plains;
+    for (long i = 0; i < 20; i++)
+    {
+        PlainA a;
+        a.id = i;
+        a.weight = 0;
+        as.push_back(pool.insert(a));
+        Plain plain;
+        plain.id = -i;
+        plains.push_back(pool.insert(plain));
+    }
+    PlainB b;
+    b.id = 100;
+    PlainB* single = pool.insert(b);
+
+    pool.destroy(as[0]);
+    pool.destroy(plains[0]);
+    pool.destroy(single);
+    check(pool.active<PlainA>() == 19 and pool.active<Plain>() == 19 and pool.active<PlainB>() == 0, test,
+          "objects destroyed from the wrong segment");
+    pool.destroy(as.begin() + 1, as.begin() + 10);
+    pool.destroy(plains.begin() + 1, plains.begin() + 10);
+    check(pool.active<PlainA>() == 10 and pool.active<Plain>() == 10, test,
+          "destroying a range of objects");
+    long ids = 0;
+    for (auto& item : pool) ids += item.id;
+    check(ids == 0, test, "wrong objects destroyed");
+
+    // Objects of a loaded snapshot are destroyed the same way.
+    const char* path = "tests.snap";
+    pool.save(path);
+    PolyPool<Plain> loaded(8);
+    loaded.setDefaultBlockSize<Plain>(8);
+    loaded.setDefaultBlockSize<PlainA>(8);
+    loaded.setDefaultBlockSize<PlainB>(8);
+    loaded.load(path);
+    std::vector<PlainA*> loadedAs;
+    for (auto& item : loaded.local<PlainA>()) loadedAs.push_back(&item);
+    loaded.destroy(loadedAs.begin(), loadedAs.end());
+    check(loaded.active<PlainA>() == 0 and loaded.active<Plain>() == 10, test,
+          "destroying objects of a loaded snapshot");
+    std::remove(path);
+}
+
+template <typename Pool>
+void checkMoveOnly(Pool& pool, const char* test)
+{
+    Unique* first = pool.template emplace<Unique>(std::unique_ptr<long>(new long(1)), std::string("first"));
+    pool.template emplace<Unique>(std::unique_ptr<long>(new long(2)), std::string("second"));
+    pool.destroy(first);
+
+    // Longer than any small string buffer, so moving it leaves it empty.
+    std::string name(64, 'n');
+    Unique* reused = pool.template emplace<Unique>(std::unique_ptr<long>(new long(3)), std::move(name));
+    check(reused == first and reused->value() == 3 and reused->name == std::string(64, 'n'), test,
+          "move-only object not constructed in the reused slot");
+    check(name.empty(), test, "rvalue argument copied rather than moved");
+
+    pool.destroy(reused);
+    Unique* inserted = pool.insert(Unique(std::unique_ptr<long>(new long(4)), std::string("fourth")));
+    check(inserted == first and inserted->value() == 4 and pool.active() == 2 and gAlive == 2, test,
+          "move-only object not moved into the reused slot");
+    pool.clear();
+}
+
+void testMoveOnly()
+{
+    const char* test = "move-only types";
+    {
+        PolyPool<Root> pool(4);
+        checkMoveOnly(pool, test);
+    }
+    check(gAlive == 0, test, "objects leaked by the open pool");
+    {
+        PolyPool<Root, Unique, Base> pool(4);
+        checkMoveOnly(pool, test);
+    }
+    check(gAlive == 0, test, "objects leaked by the closed pool");
+}
+
+static bool alignedTo(const void* address, std::size_t alignment)
+{
+    return reinterpret_cast<std::uintptr_t>(address) % alignment == 0;
+}
+
+/// Distance in bytes between two items.
+static std::ptrdiff_t distance(const void* from, const void* to)
+{
+    return static_cast<const char*>(to) - static_cast<const char*>(from);
+}
+
+/// Expects a pool with blocks of 4 items.
+template <typename Pool>
+void checkLayouts(Pool& pool, const char* test)
+{
+    std::vector<Wide*> wides;
+    bool aligned = true;
+    for (long i = 0; i < 20; i++)
+    {
+        wides.push_back(pool.template emplace<Wide>(i));
+        aligned = aligned and alignedTo(wides.back(), 64);
+    }
+    check(aligned and pool.template blocks<Wide>() == 5, test, "over-aligned slots misaligned in grown blocks");
+    for (std::size_t i = 0; i < wides.size(); i += 3)
+    {
+        pool.destroy(wides[i]);
+    }
+    const std::size_t capacity = pool.template capacity<Wide>();
+    for (long i = 0; i < 7; i++)
+    {
+        aligned = aligned and alignedTo(pool.template emplace<Wide>(i), 64);
+    }
+    check(aligned and pool.template capacity<Wide>() == capacity, test,
+          "over-aligned slots misaligned after reuse");
+
+    std::vector<Padded*> padded;
+    std::vector<Aligned*> packed;
+    for (long i = 0; i < 8; i++)
+    {
+        padded.push_back(pool.template emplace<Padded>(i));
+        packed.push_back(pool.template emplace<Aligned>(i));
+    }
+    bool strides = true;
+    for (std::size_t i = 0; i < 8; i++)
+    {
+        if (i % 4 == 0)
+        {
+            aligned = aligned and alignedTo(padded[i], 64) and alignedTo(packed[i], 64);
+            continue;
+        }
+        strides = strides and distance(padded[i - 1], padded[i]) == 64
+            and distance(packed[i - 1], packed[i]) == std::ptrdiff_t(sizeof(Aligned));
+    }
+    check(strides, test, "cache-line layouts have the wrong stride");
+    check(aligned, test, "cache-line layouts do not start blocks on a cache line");
+    pool.clear();
+}
+
+void testLayouts()
+{
+    const char* test = "alignment and slot layouts";
+    {
+        PolyPool<Root> pool(4);
+        checkLayouts(pool, test);
+    }
+    check(gAlive == 0, test, "objects leaked by the open pool");
+    {
+        PolyPool<Root, Wide, Padded, Aligned> pool(4);
+        checkLayouts(pool, test);
+    }
+    check(gAlive == 0, test, "objects leaked by the closed pool");
+}
+
+/// Expects a pool with blocks of 4 items.
+template <typename Pool>
+void checkIteration(Pool& pool, const char* test)
+{
+    std::vector<Base*> bases;
+    std::vector<Root*> others;
+    for (long i = 0; i < 30; i++)
+    {
+        bases.push_back(pool.template emplace<Base>(i));
+        others.push_back(pool.template emplace<Other>(i));
+        pool.destroy(pool.template emplace<Derived>(i));
+    }
+    // Holes within blocks, a whole empty block and an empty segment.
+    for (std::size_t i = 0; i < 30; i += 3)
+    {
+        pool.destroy(bases[i]);
+        pool.destroy(others[i + 1]);
+    }
+    for (std::size_t i = 8; i < 12; i++)
+    {
+        if (i % 3) pool.destroy(bases[i]);
+    }
+
+    std::vector<Root*> forward;
+    for (auto& item : pool) forward.push_back(&item);
+    std::vector<Root*> backward;
+    for (auto iter = pool.end(); iter != pool.begin();)
+    {
+        --iter;
+        backward.push_back(&*iter);
+    }
+    std::vector<Root*> reversed;
+    for (auto iter = pool.rbegin(); iter != pool.rend(); ++iter) reversed.push_back(&*iter);
+    std::reverse(backward.begin(), backward.end());
+    std::reverse(reversed.begin(), reversed.end());
+    check(forward.size() == pool.active() and backward == forward and reversed == forward, test,
+          "backward iteration visits other objects than forward");
+
+    std::vector<Base*> local;
+    for (auto& item : pool.template local<Base>()) local.push_back(&item);
+    std::vector<Base*> localBackward;
+    for (auto iter = pool.template end<Base>(); iter != pool.template begin<Base>();)
+    {
+        localBackward.push_back(&*--iter);
+    }
+    std::vector<Base*> localReversed;
+    for (auto iter = pool.template rbegin<Base>(); iter != pool.template rend<Base>(); ++iter)
+    {
+        localReversed.push_back(&*iter);
+    }
+    std::reverse(localBackward.begin(), localBackward.end());
+    std::reverse(localReversed.begin(), localReversed.end());
+    check(local.size() == pool.template active<Base>() and localBackward == local and localReversed == local,
+          test, "backward local iteration visits other objects than forward");
+
+    std::vector<Base*> spans;
+    for (auto block : pool.template segments<Base>())
+    {
+        block.forEachRun([&](Base* first, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; i++) spans.push_back(first + i);
+        });
+    }
+    check(spans == local, test, "block spans disagree with local iteration");
+    pool.clear();
+}
+
+void testIteration()
+{
+    const char* test = "bidirectional iteration";
+    {
+        PolyPool<Root> pool(4);
+        checkIteration(pool, test);
+    }
+    check(gAlive == 0, test, "objects leaked by the open pool");
+    {
+        PolyPool<Root, Base, Derived, Other> pool(4);
+        checkIteration(pool, test);
+    }
+    check(gAlive == 0, test, "objects leaked by the closed pool");
+}
+
+void testBulkAdd()
+{
+    const char* test = "emplace_n and insert_range";
+    {
+        PolyPool<Root> pool(7);
+        auto first = pool.emplace_n<Base>(20, 5);
+        check(first.size() == 20 and pool.active<Base>() == 20 and pool.blocks<Base>() == 3, test,
+              "emplace_n() into an empty pool");
+        for (std::size_t i = 0; i < first.size(); i += 2)
+        {
+            pool.destroy(first[i]);
+        }
+        auto second = pool.emplace_n<Base>(30, 6);
+        check(second.size() == 30 and pool.active<Base>() == 40 and pool.holes<Base>() == 0
+              and pool.blocks<Base>() == 6, test, "emplace_n() does not fill free slots first");
+        bool constructed = true;
+        for (Base* item : second) constructed = constructed and item->value() == 6;
+        check(constructed, test, "emplace_n() arguments not passed on");
+
+        std::vector<Base> source;
+        for (long i = 0; i < 25; i++) source.emplace_back(i);
+        auto fromVector = pool.insert_range(source.begin(), source.end());
+        std::list<Base> list(source.begin(), source.end());
+        auto fromList = pool.insert_range(list.begin(), list.end());
+        check(fromVector.size() == 25 and fromVector[24]->value() == 24 and fromList.size() == 25
+              and fromList[3]->value() == 3 and pool.active<Base>() == 90, test,
+              "insert_range() from random access and forward iterators");
+
+        Fragile::budget = 10;
+        bool thrown = false;
+        try
+        {
+            pool.emplace_n<Fragile>(30, 1);
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        long visited = 0;
+        for (auto& item : pool.local<Fragile>()) visited += item.value();
+        check(thrown and pool.active<Fragile>() == 10 and visited == 10, test,
+              "objects built before a constructor threw are not kept");
+        Fragile::budget = 1000;
+        pool.emplace_n<Fragile>(30, 1);
+        check(pool.active<Fragile>() == 40, test, "emplace_n() after a constructor threw");
+
+        PolyPool<Root, Base, Other> closed(16);
+        closed.emplace_n<Base>(100, 1);
+        closed.insert_range(source.begin(), source.end());
+        check(closed.blocks() == 8 and closed.active() == 125, test, "closed pool bulk adds");
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+
+void testDestroyIf()
+{
+    const char* test = "destroy_if and range destroy";
+    {
+        PolyPool<Root> pool(9);
+        for (long i = 0; i < 100; i++)
+        {
+            pool.emplace<Base>(i);
+            pool.emplace<Other>(i);
+        }
+        auto handle = pool.handle(&*pool.begin<Base>());
+        check(pool.destroy_if([](Root& item) { return item.value() % 2 == 0; }) == 100, test,
+              "wrong number of objects destroyed");
+        check(pool.resolve(handle) == nullptr, test, "handle to a destroyed object resolves");
+        check(pool.destroy_if<Other>([](Other& item) { return item.value() % 3 == 1; }) == 17, test,
+              "wrong number of objects of one type destroyed");
+        check(pool.active<Base>() == 50 and pool.active<Other>() == 33, test, "wrong objects destroyed");
+        bool odd = true;
+        for (auto& item : pool) odd = odd and item.value() % 2 == 1;
+        check(odd, test, "objects kept that pred asked to destroy");
+
+        // Mixed types, in no particular order.
+        std::vector<Root*> mixed;
+        long index = 0;
+        for (auto& item : pool)
+        {
+            if (index++ % 3 != 0) mixed.push_back(&item);
+        }
+        std::reverse(mixed.begin(), mixed.end());
+        const std::size_t before = pool.active();
+        pool.destroy(mixed.begin(), mixed.end());
+        check(pool.active() == before - mixed.size() and gAlive == long(pool.active()), test,
+              "destroying a shuffled range of mixed types");
+
+        PolyPool<Root, Base, Other> closed(5);
+        auto others = closed.emplace_n<Other>(50, 3);
+        closed.emplace_n<Base>(10, 4);
+        closed.destroy(others.begin() + 10, others.end());
+        check(closed.destroy_if([](Root& item) { return item.value() == 4; }) == 10
+              and closed.active() == 10, test, "closed pool destroy_if()");
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+
+/// Indices in items of the slots the next count objects go to.
+template <typename Pool>
+std::vector<long> reusedSlots(Pool& pool, const std::vector<Base*>& items, long count)
+{
+    std::vector<long> slots;
+    for (long i = 0; i < count; i++)
+    {
+        Base* added = pool.template emplace<Base>(i);
+        const auto found = std::find(items.begin(), items.end(), added);
+        slots.push_back(found == items.end() ? -1 : long(found - items.begin()));
+    }
+    return slots;
+}
+
+void testReusePolicies()
+{
+    const char* test = "reuse policies";
+    {
+        // Blocks 0 to 3 are full, and the last object went to block 3.
+        // Slots 5, 34 and 36 are freed in that order.
+        const PolyPoolReuse policies[] = {PolyPoolReuse::lifo, PolyPoolReuse::lowestSlot,
+                                          PolyPoolReuse::currentBlock};
+        const long expected[][3] = {{36, 34, 5}, {5, 34, 36}, {34, 36, 5}};
+        for (int policy = 0; policy < 3; policy++)
+        {
+            PolyPool<Root> pool(10);
+            pool.setReuse<Base>(policies[policy]);
+            std::vector<Base*> items;
+            for (long i = 0; i < 40; i++) items.push_back(pool.emplace<Base>(i));
+            pool.destroy(items[5]);
+            pool.destroy(items[34]);
+            pool.destroy(items[36]);
+            const std::vector<long> slots = reusedSlots(pool, items, 4);
+            check(slots[0] == expected[policy][0] and slots[1] == expected[policy][1]
+                  and slots[2] == expected[policy][2] and slots[3] == -1, test,
+                  "free slots reused in the wrong order");
+            check(pool.capacity() == 50 and pool.holes() == 0, test, "free slots not reused first");
+        }
+
+        // Switching policies keeps the free slots.
+        PolyPool<Root, Base, Other> pool(10);
+        std::vector<Base*> items;
+        for (long i = 0; i < 100; i++) items.push_back(pool.emplace<Base>(i));
+        for (long i = 1; i < 100; i += 3) pool.destroy(items[i]);
+        pool.setReuse<Base>(PolyPoolReuse::lowestSlot);
+        check(pool.holes() == 33, test, "switching policies loses free slots");
+        const std::vector<long> slots = reusedSlots(pool, items, 3);
+        check(slots[0] == 1 and slots[1] == 4 and slots[2] == 7, test,
+              "lowestSlot after switching policies");
+        pool.setReuse(PolyPoolReuse::currentBlock);
+        reusedSlots(pool, items, 30);
+        check(pool.holes() == 0 and pool.capacity() == 100 and pool.active() == 100, test,
+              "free slots not all reused after switching policies");
+
+        // Objects added with lowestSlot gather at the front, so
+        // trailing blocks empty out.
+        PolyPool<Root> packed(10);
+        packed.setReuse<Base>(PolyPoolReuse::lowestSlot);
+        std::vector<Base*> churn;
+        for (long i = 0; i < 100; i++) churn.push_back(packed.emplace<Base>(i));
+        for (long round = 0; round < 5; round++)
+        {
+            for (long i = round; i < 100; i += 5) packed.destroy(churn[i]);
+            for (long i = round; i < 100; i += 5) churn[i] = nullptr;
+            packed.emplace_n<Base>(10, round);
+        }
+        packed.shrink_to_fit();
+        check(packed.active() == 50 and packed.blocks() == 5, test, "lowestSlot leaves objects scattered");
+        for (Base* item : churn)
+        {
+            if (item) packed.destroy(item);
+        }
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+
+void testGrowthPolicies()
+{
+    const char* test = "growth policies";
+    {
+        PolyPool<Root> pool(8);
+        pool.setGrowth<Base>(PolyPoolGrowth::geometric(16, 1024));
+        pool.emplace_n<Base>(16, 1);
+        check(pool.blocks<Base>() == 1 and pool.capacity<Base>() == 16, test, "first geometric block");
+        pool.emplace<Base>(1);
+        check(pool.blocks<Base>() == 2 and pool.capacity<Base>() == 32, test, "second geometric block");
+        pool.emplace_n<Base>(3000, 1);
+        check(pool.blocks<Base>() == 9 and pool.capacity<Base>() == 3072, test,
+              "geometric blocks do not double up to their maximum");
+
+        pool.setGrowth<Other>(PolyPoolGrowth::custom([](std::size_t blocks, std::size_t)
+        {
+            return 10 + blocks;
+        }));
+        for (long i = 0; i < 100; i++) pool.emplace<Other>(i);
+        check(pool.blocks<Other>() == 8 and pool.capacity<Other>() == 108, test, "custom growth");
+
+        pool.setGrowth<Derived>(PolyPoolGrowth::custom([](std::size_t, std::size_t)
+        {
+            return std::size_t(0);
+        }));
+        pool.emplace<Derived>(1);
+        pool.emplace<Derived>(2);
+        check(pool.blocks<Derived>() == 2 and pool.capacity<Derived>() == 2, test,
+              "blocks of no items are not taken as one");
+
+        // Fixed block sizes convert to a policy, and the default
+        // policy applies to types registered afterwards.
+        pool.setGrowth<Base>(5);
+        pool.emplace_n<Base>(72, 1);
+        check(pool.blocks<Base>() == 13 and pool.capacity<Base>() == 3072 + 4 * 5, test,
+              "fixed block size after geometric growth");
+        pool.setDefaultGrowth(PolyPoolGrowth::geometric(4, 64, 1.5));
+        Fragile::budget = 1000;
+        pool.emplace_n<Fragile>(100, 1);
+        check(pool.blocks<Fragile>() == 9 and pool.capacity<Fragile>() == 135, test,
+              "default growth policy not applied");
+
+        int rejected = 0;
+        const double factors[] = {1.0, 0.5, -2.0};
+        for (double factor : factors)
+        {
+            try
+            {
+                PolyPoolGrowth::geometric(4, 64, factor);
+            }
+            catch (const std::invalid_argument&)
+            {
+                ++rejected;
+            }
+        }
+        check(rejected == 3, test, "geometric growth factors of at most one accepted");
+
+        PolyPool<Root, Base, Other> closed(8);
+        closed.setGrowth(PolyPoolGrowth::geometric(8, 4096));
+        closed.emplace_n<Base>(100000, 1);
+        check(closed.blocks<Base>() == 34, test, "closed pool growth");
+
+        // A literal block size of zero selects the size constructors.
+        PolyPool<Root> zero(0);
+        PolyPool<Root, Base> closedZero(0);
+        PolyPoolConcurrent<Root> concurrentZero(0);
+        zero.emplace<Base>(1);
+        closedZero.emplace<Base>(1);
+        concurrentZero.cache().emplace<Base>(1);
+        check(zero.capacity() == 1 and closedZero.capacity() == 1 and concurrentZero.capacity() == 1, test,
+              "literal block size of zero");
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+
+void testStats()
+{
+    const char* test = "statistics";
+    {
+        PolyPool<Root> pool(10);
+        std::vector<Base*> items;
+        for (long i = 0; i < 100; i++)
+        {
+            items.push_back(pool.emplace<Base>(i));
+            pool.emplace<Other>(i);
+        }
+        for (std::size_t i = 0; i < items.size(); i += 2)
+        {
+            pool.destroy(items[i]);
+        }
+        for (long i = 0; i < 20; i++) pool.emplace<Base>(i);
+        pool.emplace_n<Other>(15, 1);
+        long total = 0;
+        pool.for_each([&](Root& item) { total += item.value(); });
+
+        const PolyPoolStats base = pool.stats<Base>();
+        check(base.allocations == 120 and base.reuses == 20 and base.blocksCreated == 10
+              and base.blocksReleased == 0, test, "cumulative counters");
+        check(base.blocks == 10 and base.active == 70 and base.holes == 30 and base.warm == 0
+              and base.capacity == 100 and base.holesSkipped == 30, test, "state counters");
+        check(base.bytesReserved == 100 * sizeof(Base) and base.bytesLive == 70 * sizeof(Base), test,
+              "byte counters");
+        check(base.fragmentation() == 0.3, test, "fragmentation ratio");
+        check(pool.stats<Derived>().json() == PolyPoolStats().json(), test, "stats of an unknown type");
+
+        for (std::size_t i = 1; i < items.size(); i += 2)
+        {
+            pool.destroy(items[i]);
+        }
+        pool.shrink_to_fit();
+        const PolyPoolStats all = pool.stats();
+        check(all.allocations == 235 and all.blocksReleased > 0 and all.active == pool.active()
+              and all.capacity == pool.capacity() and all.blocks == pool.blocks(), test, "pool-wide counters");
+
+        PolyPool<Root, Base, Other> closed(4);
+        closed.emplace<Base>(1);
+        const std::string json = closed.stats().json();
+        check(json.find("\"allocations\":1,") != std::string::npos
+              and json.find("\"capacity\":4,") != std::string::npos
+              and json.find("\"fragmentation\":0}") != std::string::npos
+              and json.front() == '{', test, "JSON output");
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+
+void testDefragmentShrink()
+{
+    const char* test = "defragment and shrink_to_fit";
+    {
+        PolyPool<Root> pool(8);
+        std::vector<Base*> items;
+        for (long i = 0; i < 64; i++)
+        {
+            items.push_back(pool.emplace<Base>(i));
+        }
+        for (std::size_t i = 0; i < items.size(); i++)
+        {
+            if (i % 4 != 0) pool.destroy(items[i]);
+        }
+        const long before = sum(pool);
+        long relocated = 0;
+        pool.defragment<Base>([&](Base* from, Base* to)
+        {
+            relocated += from->value() == to->value();
+        });
+        check(relocated > 0, test, "nothing relocated");
+        check(sum(pool) == before and pool.active() == 16, test, "items changed by defragmenting");
+        check(pool.holes() == 0, test, "holes left after defragmenting");
+
+        pool.shrink_to_fit();
+        check(pool.blocks() == 2 and pool.capacity() == 16, test, "empty blocks kept");
+        check(sum(pool) == before, test, "items changed by shrinking");
+        pool.emplace<Base>(100);
+        check(pool.active() == 17 and sum(pool) == before + 100, test, "adding after shrinking");
+
+        PolyPool<Root, Base, Derived> closed(8);
+        for (long i = 0; i < 40; i++)
+        {
+            Base* item = closed.emplace<Derived>(i);
+            if (i % 2) closed.destroy(item);
+        }
+        const long closedBefore = sum(closed);
+        closed.compactify();
+        check(sum(closed) == closedBefore and closed.holes() == 0 and closed.capacity() == 24, test,
+              "compactifying the closed pool");
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+
+/// Counts visits by static type, with a Root& fallback.
+struct TypedVisit
+{
+    long* typed;
+    long* others;
+    void operator()(Tally& tally) { ++tally.visits; ++*typed; }
+    void operator()(Root&) { ++*others; }
+};
+
+/// Fills a pool with Tally and Base objects, leaving holes among the Tallies.
+template <typename Pool>
+void fillTallies(Pool& pool)
+{
+    auto tallies = pool.template emplace_n<Tally>(300);
+    pool.template emplace_n<Base>(100, 1);
+    for (std::size_t i = 0; i < tallies.size(); i += 3)
+    {
+        pool.destroy(tallies[i]);
+    }
+}
+
+template <typename Pool>
+bool visitedTimes(Pool& pool, long times)
+{
+    bool all = true;
+    for (auto& tally : pool.template local<Tally>()) all = all and tally.visits == times;
+    return all;
+}
+
+void testForEach()
+{
+    const char* test = "for_each";
+    {
+        PolyPool<Root> pool(32);
+        fillTallies(pool);
+        long typed = 0;
+        long others = 0;
+        pool.for_each<Tally>(TypedVisit{&typed, &others});
+        check(visitedTimes(pool, 1) and typed == 200 and others == 100, test,
+              "listed types not visited by static type exactly once");
+        typed = others = 0;
+        pool.for_each<Tally, Base>(TypedVisit{&typed, &others});
+        check(visitedTimes(pool, 2) and typed == 200 and others == 100, test,
+              "objects of several listed types not visited exactly once");
+        typed = others = 0;
+        pool.for_each(TypedVisit{&typed, &others});
+        check(visitedTimes(pool, 2) and typed == 0 and others == 300, test,
+              "whole-pool for_each() does not pass Root&");
+    }
+    check(gAlive == 0, test, "objects leaked by the open pool");
+    {
+        PolyPool<Root, Base, Tally> pool(32);
+        fillTallies(pool);
+        long typed = 0;
+        long others = 0;
+        pool.for_each<Tally>(TypedVisit{&typed, &others});
+        check(visitedTimes(pool, 1) and typed == 200 and others == 100, test,
+              "listed types not visited by static type exactly once in the closed pool");
+        typed = others = 0;
+        pool.for_each(TypedVisit{&typed, &others});
+        check(visitedTimes(pool, 2) and typed == 200 and others == 100, test,
+              "whole-pool for_each() does not pass static types in the closed pool");
+    }
+    check(gAlive == 0, test, "objects leaked by the closed pool");
+}
+
+void testParallelForEach()
+{
+    const char* test = "parallel_for_each";
+    {
+        PolyPool<Root> pool(1000);
+        auto tallies = pool.emplace_n<Tally>(30000);
+        pool.emplace_n<Base>(10000, 1);
+        for (std::size_t i = 0; i < tallies.size(); i++)
+        {
+            if (i % 3 == 0 or (i / 1000) % 4 == 1) pool.destroy(tallies[i]);
+        }
+        PolyPoolExecutor executor(3);
+        std::atomic<long> visits(0);
+        pool.parallel_for_each([&](Root& item)
+        {
+            ++visits;
+            if (Tally* tally = dynamic_cast<Tally*>(&item)) ++tally->visits;
+        }, executor);
+        bool once = true;
+        for (auto& tally : pool.local<Tally>()) once = once and tally.visits == 1;
+        check(visits == long(pool.active()) and once, test, "objects not visited exactly once");
+
+        std::atomic<long> typed(0);
+        std::atomic<long> others(0);
+        struct Visit
+        {
+            std::atomic<long>* typed;
+            std::atomic<long>* others;
+            void operator()(Tally& tally) { ++tally.visits; ++*typed; }
+            void operator()(Root&) { ++*others; }
+        };
+        pool.parallel_for_each<Tally>(Visit{&typed, &others}, executor);
+        once = true;
+        for (auto& tally : pool.local<Tally>()) once = once and tally.visits == 2;
+        check(once and typed == long(pool.active<Tally>()) and others == 10000, test,
+              "listed types not visited by static type exactly once");
+
+        // Tasks running parallel_for_each themselves, on the same
+        // executor, must neither deadlock nor skip objects.
+        std::vector<PolyPool<Root, Base> > inners(6);
+        for (auto& inner : inners) inner.emplace_n<Base>(20000, 1);
+        std::atomic<long> nested(0);
+        PolyPoolExecutor::task_list tasks;
+        for (std::size_t task = 0; task < inners.size(); task++)
+        {
+            tasks.push_back([&, task]
+            {
+                inners[task].parallel_for_each([&](Root& item) { nested += item.value(); }, executor);
+            });
+        }
+        executor.run(tasks);
+        check(nested == 6 * 20000, test, "nested runs skip objects");
+        nested = 0;
+        pool.parallel_for_each<Base>([&](Root&)
+        {
+            if (nested++ == 0) inners[0].parallel_for_each([&](Root&) { ++nested; }, executor);
+        }, executor);
+        check(nested == 10000 + long(pool.active<Tally>()) + 20000, test,
+              "parallel_for_each() called from a visit");
+
+        bool thrown = false;
+        try
+        {
+            pool.parallel_for_each([](Root&) { throw std::runtime_error("visit failed"); }, executor);
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        check(thrown, test, "exceptions thrown by visits are not passed on");
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+
+template <typename Pool>
+void checkWarmRecycling(Pool& pool, const char* test)
+{
+    Connection::resets = 0;
+    pool.template prewarm<Connection>(10, 7);
+    long visited = 0;
+    pool.for_each([&](Root&) { ++visited; });
+    check(gAlive == 10 and pool.template warm<Connection>() == 10 and pool.template active<Connection>() == 0
+          and visited == 0, test, "prewarm() objects are active");
+
+    std::vector<Connection*> items;
+    for (long i = 0; i < 12; i++) items.push_back(pool.template acquire<Connection>(i));
+    check(gAlive == 12 and pool.template active<Connection>() == 12 and pool.template warm<Connection>() == 0,
+          test, "acquire() does not take prewarmed objects first");
+    for (Connection* item : items) pool.release(item);
+    check(Connection::resets == 12 and gAlive == 12 and pool.template warm<Connection>() == 12, test,
+          "release() destructs or does not reset objects");
+    Connection* again = pool.template acquire<Connection>(99);
+    check(again == items.back() and again->id == 11 and again->buffer.size() == 4096, test,
+          "acquire() does not return the last released object as is");
+    check(pool.template stats<Connection>().warm == 11, test, "stats() miscount released objects");
+
+    pool.defragment();
+    check(gAlive == 1 and pool.template warm<Connection>() == 0 and pool.template active<Connection>() == 1, test,
+          "defragment() keeps released objects");
+    pool.template prewarm<Connection>(3, 1);
+    pool.shrink_to_fit();
+    check(gAlive == 1 and pool.template warm<Connection>() == 0, test, "shrink_to_fit() keeps released objects");
+    pool.template prewarm<Connection>(3, 1);
+    pool.clear();
+    check(gAlive == 0 and pool.template warm<Connection>() == 0, test, "clear() keeps released objects");
+    pool.template prewarm<Connection>(3, 1);
+
+    // Objects given through a base are reset and kept for their own type.
+    Root* base = pool.template acquire<Connection>(5);
+    pool.release(base);
+    check(Connection::resets == 13 and pool.template warm<Connection>() == 3
+          and pool.template acquire<Connection>(6) == base, test, "release() through a base pointer");
+}
+
+void testWarmRecycling()
+{
+    const char* test = "release, acquire and prewarm";
+    {
+        PolyPool<Root> pool(4);
+        checkWarmRecycling(pool, test);
+        pool.setReuse<Connection>(PolyPoolReuse::lowestSlot);
+        check(pool.warm<Connection>() == 0, test, "switching policies keeps released objects");
+
+        PolyPool<Root> other;
+        Base* stranger = other.emplace<Base>(1);
+        bool threw = false;
+        try
+        {
+            pool.release(stranger);
+        }
+        catch (const std::invalid_argument&)
+        {
+            threw = true;
+        }
+        check(threw and other.active() == 1, test, "object of another pool released");
+    }
+    check(gAlive == 0, test, "objects leaked by the open pool");
+    {
+        PolyPool<Root, Connection, Base> pool(4);
+        checkWarmRecycling(pool, test);
+    }
+    check(gAlive == 0, test, "objects leaked by the closed pool");
+}
+
+void testHandles()
+{
+    const char* test = "handle invalidation";
+    PolyPool<Root> pool(4);
+    std::vector<PolyPool<Root>::Handle<Base> > handles;
+    for (long i = 0; i < 20; i++)
+    {
+        handles.push_back(pool.handle(pool.emplace<Base>(i)));
+    }
+    pool.destroy(pool.resolve(handles[3]));
+    check(pool.resolve(handles[3]) == nullptr, test, "handle to destroyed item resolves");
+    pool.emplace<Base>(99);
+    check(pool.resolve(handles[3]) == nullptr, test, "handle resolves to the item reusing its slot");
+
+    for (long i = 0; i < 20; i += 2)
+    {
+        if (i != 2) pool.destroy(pool.resolve(handles[i]));
+    }
+    pool.defragment();
+    pool.shrink_to_fit();
+    bool valid = true;
+    for (long i = 5; i < 20; i += 2)
+    {
+        const Base* item = pool.resolve(handles[i]);
+        valid = valid and item and item->value() == i;
+    }
+    check(valid, test, "handles lost track of moved items");
+    check(pool.resolve(handles[2]) and pool.resolve(handles[2])->value() == 2, test,
+          "handle lost track of moved item");
+
+    pool.clear();
+    check(pool.resolve(handles[1]) == nullptr, test, "handle resolves after clear()");
+
+    // Items filed under another type than asked for have no handle.
+    Base* derived = pool.emplace<Derived>(5);
+    bool threw = false;
+    try
+    {
+        pool.handle(derived);
+    }
+    catch (const std::invalid_argument&)
+    {
+        threw = true;
+    }
+    check(threw and pool.resolve(pool.handle(static_cast<Derived*>(derived))) == derived, test,
+          "handle issued through a base pointer");
+
+    // Destroyed and released items have no handle, so none resolves to
+    // the item later reusing their slot.
+    Base* dead = pool.emplace<Base>(1);
+    pool.destroy(dead);
+    threw = false;
+    try
+    {
+        pool.handle(dead);
+    }
+    catch (const std::invalid_argument&)
+    {
+        threw = true;
+    }
+    check(threw and pool.emplace<Base>(2) == dead, test, "handle issued for a destroyed item");
+
+    PolyPool<Root, Base, Derived, Other> closed;
+    Base* closedDerived = closed.emplace<Derived>(3);
+    threw = false;
+    try
+    {
+        closed.handle(closedDerived);
+    }
+    catch (const std::invalid_argument&)
+    {
+        threw = true;
+    }
+    check(threw, test, "closed pool handle issued through a base pointer");
+    Base* closedDead = closed.emplace<Base>(4);
+    closed.release(closedDead);
+    threw = false;
+    try
+    {
+        closed.handle(closedDead);
+    }
+    catch (const std::invalid_argument&)
+    {
+        threw = true;
+    }
+    check(threw, test, "closed pool handle issued for a released item");
+    auto handle = closed.handle(closed.emplace<Other>(7));
+    check(closed.resolve(handle) and closed.resolve(handle)->value() == 7, test, "closed pool handle");
+    closed.destroy(closed.resolve(handle));
+    closed.emplace<Other>(8);
+    check(closed.resolve(handle) == nullptr, test, "closed pool handle resolves after destroy");
+}
+
+void testSnapshots()
+{
+    const char* test = "snapshot round trips";
+    const char* path = "tests.snap";
+    {
+        PolyPool<Root> pool(16);
+        std::vector<Particle*> items;
+        for (long i = 0; i < 100; i++)
+        {
+            items.push_back(pool.emplace<Particle>(Particle::State{i, -i}));
+        }
+        for (std::size_t i = 0; i < items.size(); i += 7)
+        {
+            pool.destroy(items[i]);
+        }
+        pool.save(path);
+
+        PolyPool<Root> loaded(16);
+        loaded.setDefaultBlockSize<Particle>(16);
+        loaded.load(path);
+        check(sum(loaded) == sum(pool) and loaded.active() == pool.active(), test,
+              "hooked type changed by saving and loading");
+        check(loaded.holes() == pool.holes(), test, "free slots not restored");
+        loaded.emplace<Particle>(Particle::State{1000, 0});
+        check(loaded.active() == pool.active() + 1 and loaded.holes() == pool.holes() - 1, test,
+              "adding to a loaded pool does not reuse free slots");
+
+        bool thrown = false;
+        try
+        {
+            loaded.load(path);
+        }
+        catch (const std::logic_error&)
+        {
+            thrown = true;
+        }
+        check(thrown, test, "loading into a type holding blocks is not rejected");
+    }
+    {
+        PolyPool<Plain, PlainA, PlainB> pool(32);
+        for (long i = 0; i < 500; i++)
+        {
+            PlainA a;
+            a.id = i;
+            a.weight = double(i) / 2;
+            PlainA* item = pool.insert(a);
+            if (i % 5 == 0) pool.destroy(item);
+            if (i % 3 == 0)
+            {
+                PlainB b;
+                b.id = -i;
+                std::memset(b.tag, 'x', sizeof(b.tag));
+                pool.insert(b);
+            }
+        }
+        pool.save(path);
+
+        PolyPool<Plain, PlainA, PlainB> loaded(32);
+        loaded.load(path);
+        long expected = 0;
+        long actual = 0;
+        for (auto& item : pool) expected += item.id;
+        for (auto& item : loaded) actual += item.id;
+        check(actual == expected and loaded.active() == pool.active(), test,
+              "bitwise types changed by saving and loading");
+        check(loaded.holes<PlainA>() == pool.holes<PlainA>(), test, "free slots not restored");
+
+        // Loaded blocks stay writable and may be compacted and released.
+        for (auto& item : loaded.local<PlainA>()) item.weight = 0;
+        loaded.compactify();
+        long compacted = 0;
+        for (auto& item : loaded) compacted += item.id;
+        check(compacted == expected, test, "compacting a loaded pool");
+    }
+    std::remove(path);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+void testMappedResource()
+{
+    const char* test = "mapped block storage";
+    PolyPoolMappedResource mapped(16 << 20);
+    {
+        // Blocks of 16 KiB, a whole number of pages on common systems.
+        const std::size_t blockSize = 16384 / sizeof(Base);
+        const std::size_t blockBytes = blockSize * sizeof(Base);
+        PolyPool<Root> pool(blockSize);
+        pool.setBlockResource<Base>(&mapped);
+        std::vector<Base*> items;
+        for (long i = 0; i < long(8 * blockSize); i++) items.push_back(pool.emplace<Base>(i));
+        pool.emplace<Other>(0);
+        bool contiguous = true;
+        const Base* first = pool.segments<Base>()[0].data();
+        for (std::size_t block = 0; block < pool.blocks<Base>(); block++)
+        {
+            contiguous = contiguous and pool.segments<Base>()[block].data() == first + block * blockSize;
+        }
+        check(contiguous and mapped.used() == 8 * blockBytes and mapped.released() == 0, test,
+              "blocks not taken from the range one after the other");
+
+        bool thrown = false;
+        try
+        {
+            pool.setBlockResource<Base>(PolyPoolMemoryResource::defaultResource());
+        }
+        catch (const std::logic_error&)
+        {
+            thrown = true;
+        }
+        check(thrown, test, "changing the resource of a type holding blocks is not rejected");
+
+        for (std::size_t i = 0; i < 4 * blockSize; i++) pool.destroy(items[i]);
+        pool.shrink_to_fit();
+        check(pool.blocks<Base>() == 4 and mapped.released() == 4 * blockBytes, test,
+              "shrink_to_fit() does not release blocks to the system");
+        pool.emplace_n<Base>(2 * blockSize, 1);
+        check(mapped.used() == 8 * blockBytes and mapped.released() == 2 * blockBytes, test,
+              "released parts of the range are not reused");
+        long total = 0;
+        for (auto it = pool.begin<Base>(); it != pool.end<Base>(); ++it) total += it->value();
+        const long kept = long(4 * blockSize) * long(12 * blockSize - 1) / 2;
+        check(total == kept + long(2 * blockSize), test, "objects changed by releasing blocks");
+
+        pool.clear();
+        check(mapped.released() == mapped.used(), test, "clear() does not release all blocks");
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+#endif
+
+void testSharedDestroy()
+{
+    const char* test = "shared pool destroy";
+    {
+        PolyPoolShared<Root> pool(8);
+        Base* derived = pool.emplace<Derived>(1);
+        Root* other = pool.emplace<Other>(2);
+        pool.emplace<Base>(3);
+        pool.destroy(derived);
+        pool.destroy(other);
+        long total = 0;
+        pool.for_each([&](Root& item) { total += item.value(); });
+        check(pool.active() == 1 and total == 3 and gAlive == 1, test,
+              "objects destroyed through their base");
+    }
+    check(gAlive == 0, test, "objects leaked");
+
+    PolyPoolShared<Plain> pool(8);
+    PlainA a;
+    a.id = 1;
+    a.weight = 0;
+    Plain plain;
+    plain.id = 2;
+    PlainA* first = pool.insert(a);
+    pool.insert(a);
+    Plain* second = pool.insert(plain);
+    pool.destroy(first);
+    pool.destroy(second);
+    long ids = 0;
+    pool.for_each([&](Plain& item) { ids += item.id; });
+    check(pool.active() == 1 and ids == 1, test, "destroying objects of a non-polymorphic root");
+
+    PolyPoolShared<Plain> single(0);
+    Plain* one = single.insert(plain);
+    Plain* two = single.insert(plain);
+    single.destroy(one);
+    long remaining = 0;
+    single.for_each([&](Plain& item) { remaining += item.id; });
+    check(single.active() == 1 and remaining == 2 and two->id == 2, test,
+          "a block size of zero is kept");
+}
+
+void testSharedReadersAndWriter()
+{
+    const char* test = "shared pool readers and writer";
+    {
+        PolyPoolShared<Root> pool(16);
+        const long count = 4000;
+        std::atomic<bool> done(false);
+        std::atomic<long> torn(0), shrunk(0), passes(0);
+
+        // Readers check that every object they see is whole, and that
+        // the count never drops while the writer adds objects.
+        auto read = [&]
+        {
+            size_t last = 0;
+            while (not done.load())
+            {
+                size_t visited = 0;
+                pool.for_each([&](const Root& item)
+                {
+                    ++visited;
+                    const Derived* derived = dynamic_cast<const Derived*>(&item);
+                    if (derived ? derived->mValue != derived->mExtra
+                                : item.value() < 0 or item.value() >= count)
+                    {
+                        ++torn;
+                    }
+                });
+                if (visited < last) ++shrunk;
+                last = visited;
+                ++passes;
+            }
+        };
+        auto add = [&](long first, long step)
+        {
+            passes = 0;
+            done = false;
+            std::vector<std::thread> readers;
+            for (int r = 0; r < 3; r++) readers.emplace_back(read);
+            while (passes.load() == 0) std::this_thread::yield();
+            std::vector<Root*> items;
+            for (long i = first; i < count; i += step)
+            {
+                items.push_back(i % 2 ? static_cast<Root*>(pool.emplace<Derived>(i))
+                                      : static_cast<Root*>(pool.emplace<Other>(i)));
+            }
+            done = true;
+            for (auto& reader : readers) reader.join();
+            return items;
+        };
+
+        std::vector<Root*> items = add(0, 1);
+        check(pool.active() == static_cast<size_t>(count), test, "objects added while being read");
+
+        // Destroying needs the readers gone; adding again reuses the
+        // freed slots while they read.
+        for (size_t i = 0; i < items.size(); i += 2) pool.destroy(items[i]);
+        add(0, 2);
+        check(pool.active() == static_cast<size_t>(count) and gAlive == count, test,
+              "freed slots reused while being read");
+        check(torn == 0, test, "readers saw a torn or unconstructed object");
+        check(shrunk == 0, test, "readers saw the count drop while objects were added");
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+
+void testConcurrentRemoteFree()
+{
+    const char* test = "concurrent remote free";
+    {
+        PolyPoolConcurrent<Root> pool(64);
+        const long count = 20000;
+
+        auto cache = pool.cache();
+        std::vector<Root*> items;
+        for (long i = 0; i < count; i++)
+        {
+            items.push_back(i % 2 ? static_cast<Root*>(cache.emplace<Base>(i))
+                                  : static_cast<Root*>(cache.emplace<Other>(i)));
+        }
+
+        // Another thread destroys every item, which are all remote to
+        // its cache, while the owner keeps creating and destroying
+        // items and so collects remote frees concurrently.
+        std::atomic<bool> destroying(true);
+        std::thread consumer([&]
+        {
+            auto remote = pool.cache();
+            for (Root* item : items)
+            {
+                remote.destroy(item);
+            }
+            destroying = false;
+        });
+        for (long i = 0; destroying; i++)
+        {
+            if (i % 2) cache.destroy(cache.emplace<Base>(i));
+            else cache.destroy(cache.emplace<Other>(i));
+        }
+        consumer.join();
+
+        check(pool.active() == 0, test, "remotely destroyed objects still active");
+        check(gAlive == 0, test, "remotely destroyed objects not destructed");
+
+        // The owning cache takes the remotely freed slots back.
+        const std::size_t capacity = pool.capacity();
+        for (long i = 0; i < count; i++)
+        {
+            if (i % 2) cache.emplace<Base>(i);
+            else cache.emplace<Other>(i);
+        }
+        check(pool.capacity() == capacity and pool.active() == std::size_t(count), test,
+              "remotely freed slots are not reused");
+
+        // Objects of another pool are found in no block of this one.
+        PolyPoolConcurrent<Root> other(8);
+        auto foreign = other.cache();
+        Base* stranger = foreign.emplace<Base>(0);
+        bool threw = false;
+        try
+        {
+            cache.destroy(stranger);
+        }
+        catch (const std::invalid_argument&)
+        {
+            threw = true;
+        }
+        check(threw and other.active() == 1, test, "object of another pool accepted");
+    }
+    check(gAlive == 0, test, "objects leaked");
+}
+
+
+void testConcurrentPlainRoot()
+{
+    const char* test = "concurrent pool with a non-polymorphic root";
+    PolyPoolConcurrent<Plain> pool(8);
+    auto cache = pool.cache();
+    std::vector<PlainA*> as;
+    for (long i = 0; i < 20; i++)
+    {
+        PlainA a;
+        a.id = i;
+        a.weight = 0;
+        as.push_back(cache.insert(a));
+    }
+    Plain plain;
+    plain.id = 100;
+    Plain* single = cache.insert(plain);
+    for (std::size_t i = 0; i < as.size(); i += 2)
+    {
+        cache.destroy(as[i]);
+    }
+    cache.destroy(single);
+    long ids = 0;
+    for (auto& item : pool) ids += item.id;
+    check(pool.active() == 10 and ids == 100, test, "wrong objects destroyed");
+
+    const std::size_t capacity = pool.capacity();
+    for (long i = 0; i < 10; i++)
+    {
+        PlainA a;
+        a.id = 0;
+        a.weight = 0;
+        cache.insert(a);
+    }
+    check(pool.capacity() == capacity and pool.active() == 20, test, "freed slots are not reused");
+}
+
+void testConcurrentResource()
+{
+    const char* test = "concurrent pool memory resource";
+    CountingResource resource;
+    {
+        const long before = gNews;
+        PolyPoolConcurrent<Root> pool(16, &resource);
+        {
+            auto cache = pool.cache();
+            for (long i = 0; i < 100; i++)
+            {
+                cache.emplace<Base>(i);
+                cache.destroy(cache.emplace<Derived>(i));
+            }
+        }
+        auto again = pool.cache();
+        again.emplace<Derived>(100);
+        check(pool.active() == 101 and resource.live > 0, test, "wrong objects added");
+        check(gNews == before, test, "bookkeeping allocated from the global heap");
+    }
+    check(resource.live == 0, test, "memory not returned to the resource");
+    check(gAlive == 0, test, "objects leaked");
+}
+
+void testColumns()
+{
+    const char* test = "column storage";
+    PolyPoolColumns<Body> columns(64);
+    std::vector<std::size_t> rows;
+    for (int i = 0; i < 500; i++)
+    {
+        rows.push_back(columns.insert(Body{float(i), float(2 * i), i}));
+    }
+    check(columns.active() == 500 and columns.blocks() == 8, test, "wrong number of rows or blocks");
+
+    bool aligned = true;
+    for (std::size_t block = 0; block < columns.blocks(); block++)
+    {
+        auto xs = columns.column<0>(block);
+        auto ys = columns.column<1>(block);
+        aligned = aligned and reinterpret_cast<std::uintptr_t>(xs.data()) % 64 == 0
+            and reinterpret_cast<std::uintptr_t>(ys.data()) % 64 == 0;
+        for (std::size_t i = 0; i < xs.size(); i++) xs[i] += ys[i];
+    }
+    check(aligned, test, "columns not aligned to cache lines");
+    const Body body = columns.get(rows[10]);
+    check(body.x == 30 and body.y == 20 and body.id == 10, test, "columns and rows disagree");
+
+    for (std::size_t i = 0; i < rows.size(); i += 2)
+    {
+        columns.destroy(rows[i]);
+    }
+    check(not columns.contains(rows[0]) and columns.contains(rows[1]), test, "destroyed rows still live");
+    int rejected = 0;
+    const std::size_t unused[] = {rows[0], columns.capacity()};
+    for (std::size_t row : unused)
+    {
+        try
+        {
+            columns.destroy(row);
+        }
+        catch (const std::invalid_argument&)
+        {
+            ++rejected;
+        }
+    }
+    check(rejected == 2 and columns.active() == 250, test, "rows without items destroyed");
+    long ids = 0;
+    columns.for_each([&](Body& item)
+    {
+        ids += item.id;
+        item.id = -item.id;
+    });
+    check(ids == 62500 and columns.field<2>(rows[1]) == -1, test, "for_each() visits or stores wrong rows");
+    const std::size_t row = columns.emplace();
+    check(row == rows[498] and columns.get(row).id == 0 and columns.blocks() == 8, test,
+          "free rows are not reused");
+
+    PolyPoolColumns<Body> single(0);
+    check(single.blockSize() == 1, test, "a block size of zero is kept");
+    const std::size_t first = single.insert(Body{1, 2, 3});
+    const std::size_t second = single.insert(Body{4, 5, 6});
+    check(single.blocks() == 2 and single.get(first).id == 3 and single.get(second).id == 6, test,
+          "single-row blocks");
+}
+
+int main()
+{
+    testSmallTypeReuse();
+    testBaseDestroyOpen();
+    testBaseDestroyClosed();
+    testPlainRootDestroy();
+    testMoveOnly();
+    testLayouts();
+    testIteration();
+    testBulkAdd();
+    testDestroyIf();
+    testReusePolicies();
+    testGrowthPolicies();
+    testStats();
+    testDefragmentShrink();
+    testForEach();
+    testParallelForEach();
+    testWarmRecycling();
+    testHandles();
+    testSnapshots();
+    testColumns();
+#if defined(__unix__) || defined(__APPLE__)
+    testMappedResource();
+#endif
+    testSharedDestroy();
+    testSharedReadersAndWriter();
+    testConcurrentRemoteFree();
+    testConcurrentPlainRoot();
+    testConcurrentResource();
+
+    if (gFailures)
+    {
+        std::printf("%d check(s) failed\n", gFailures);
+        return 1;
+    }
+    std::printf("All tests passed\n");
+    return 0;
+}